@@ -0,0 +1,279 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "autoindex.h"
+#include "bundle.h"
+#include "header.h"
+
+#define LISTING_INITIAL_SIZE 4096
+#define MIME_HTML "text/html"
+#define PARENT_DIR ".."
+#define CURRENT_DIR "."
+#define ROOT_URI "/"
+#define URI_UNRESERVED "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~"
+
+// Cached HTML listings of directories without an index.html.
+
+// A growable buffer the listing is rendered into. Allocation failure is remembered and checked once at the end.
+typedef struct listing_t {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool is_failed;
+} listing_t;
+
+typedef struct dir_entry_t {
+    char *name;
+    bool is_dir;
+} dir_entry_t;
+
+static autoindex_page_t *cache[AUTOINDEX_CACHE_SLOTS];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function prototypes.
+static bool page_matches(const autoindex_page_t *page, const char *dir_path, const struct stat *st);
+static autoindex_page_t *render_page(int dir_fd, const char *dir_path, const char *uri, const struct stat *st);
+static void render_listing(listing_t *out, const char *uri, const dir_entry_t *entries, size_t n_entries);
+static int compare_entries(const void *a, const void *b);
+static void listing_append(listing_t *out, const char *str);
+static void listing_append_len(listing_t *out, const char *str, size_t len);
+static void listing_append_escaped(listing_t *out, const char *str);
+static void listing_append_uri_encoded(listing_t *out, const char *str);
+static void free_page(autoindex_page_t *page);
+
+// Gets the listing of the directory at dir_path, rendering it if it is not cached or the directory has changed since.
+autoindex_page_t *autoindex_get(const char *dir_path, const char *uri) {
+    int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(dir_fd, &st) < 0) {
+        close(dir_fd);
+        return NULL;
+    }
+
+    size_t slot = bundle_hash(dir_path, strlen(dir_path)) & (AUTOINDEX_CACHE_SLOTS - 1);
+    pthread_mutex_lock(&cache_lock);
+    autoindex_page_t *page = cache[slot];
+    if (page != NULL && page_matches(page, dir_path, &st)) {
+        page->refs++;
+        pthread_mutex_unlock(&cache_lock);
+        close(dir_fd);
+        return page;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // Render without holding the lock, so that listing a large directory does not hold up other lookups.
+    page = render_page(dir_fd, dir_path, uri, &st);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    // With coarse timestamps, a directory modified within the current second could change again without its mtime
+    // changing, so its listing is served but not cached.
+    if (st.st_mtim.tv_sec < time(NULL)) {
+        pthread_mutex_lock(&cache_lock);
+        autoindex_page_t *replaced = cache[slot];
+        cache[slot] = page;
+        page->refs++;
+        bool is_replaced_unused = replaced != NULL && --replaced->refs == 0;
+        pthread_mutex_unlock(&cache_lock);
+        if (is_replaced_unused) {
+            free_page(replaced);
+        }
+    }
+    return page;
+}
+
+void autoindex_release(autoindex_page_t *page) {
+    pthread_mutex_lock(&cache_lock);
+    bool is_unused = --page->refs == 0;
+    pthread_mutex_unlock(&cache_lock);
+    if (is_unused) {
+        free_page(page);
+    }
+}
+
+// True if a cached page is still the listing of the directory, i.e. the same directory has not been modified since.
+static bool page_matches(const autoindex_page_t *page, const char *dir_path, const struct stat *st) {
+    return page->dev == st->st_dev && page->ino == st->st_ino && page->mtime.tv_sec == st->st_mtim.tv_sec &&
+           page->mtime.tv_nsec == st->st_mtim.tv_nsec && strcmp(page->dir_path, dir_path) == 0;
+}
+
+// Reads and sorts a directory's entries, then renders them into a new page with one reference. Closes dir_fd.
+static autoindex_page_t *render_page(int dir_fd, const char *dir_path, const char *uri, const struct stat *st) {
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        close(dir_fd);
+        return NULL;
+    }
+
+    // List what the server could serve: regular files, and directories which can be listed in turn.
+    dir_entry_t *entries = NULL;
+    size_t n_entries = 0, cap = 0;
+    bool is_failed = false;
+    struct dirent *ent;
+    while (!is_failed && (ent = readdir(dir)) != NULL) {
+        struct stat ent_st;
+        if (strcmp(ent->d_name, CURRENT_DIR) == 0 || strcmp(ent->d_name, PARENT_DIR) == 0 ||
+            fstatat(dirfd(dir), ent->d_name, &ent_st, 0) < 0 || !(S_ISREG(ent_st.st_mode) || S_ISDIR(ent_st.st_mode))) {
+            continue;
+        }
+        if (n_entries == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            dir_entry_t *grown = realloc(entries, sizeof(*entries) * cap);
+            if (grown == NULL) {
+                is_failed = true;
+                break;
+            }
+            entries = grown;
+        }
+        entries[n_entries].name = strdup(ent->d_name);
+        entries[n_entries].is_dir = S_ISDIR(ent_st.st_mode);
+        is_failed = entries[n_entries++].name == NULL;
+    }
+    closedir(dir);
+
+    listing_t out = {.buf = NULL, .len = 0, .cap = 0, .is_failed = is_failed};
+    if (!is_failed) {
+        qsort(entries, n_entries, sizeof(*entries), compare_entries);
+        render_listing(&out, uri, entries, n_entries);
+    }
+    for (size_t i = 0; i < n_entries; i++) {
+        free(entries[i].name);
+    }
+    free(entries);
+
+    autoindex_page_t *page = out.is_failed ? NULL : malloc(sizeof(*page));
+    char *page_dir_path = page == NULL ? NULL : strdup(dir_path);
+    if (page_dir_path == NULL) {
+        free(page);
+        free(out.buf);
+        return NULL;
+    }
+    page->dir_path = page_dir_path;
+    page->dev = st->st_dev;
+    page->ino = st->st_ino;
+    page->mtime = st->st_mtim;
+    page->refs = 1;
+    page->body = out.buf;
+    page->body_len = out.len;
+    page->header_len = header_begin_200(page->header, out.len, MIME_HTML, st->st_mtime, NULL);
+    return page;
+}
+
+// Renders a listing with relative links, so that it works however the directory's path was spelt in the request. Each
+// link starts with "./" and percent-encodes the name, so that no file name can be read as a scheme (e.g. a file named
+// "javascript:alert(1)"), a query or a fragment.
+static void render_listing(listing_t *out, const char *uri, const dir_entry_t *entries, size_t n_entries) {
+    listing_append(out, "<!DOCTYPE html>\n<html>\n    <head>\n        <title>Index of ");
+    listing_append_escaped(out, uri);
+    listing_append(out, "</title>\n    </head>\n    <body>\n        <h1>Index of ");
+    listing_append_escaped(out, uri);
+    listing_append(out, "</h1>\n        <ul>\n");
+    if (strcmp(uri, ROOT_URI) != 0) {
+        listing_append(out, "            <li><a href=\"../\">../</a></li>\n");
+    }
+    for (size_t i = 0; i < n_entries; i++) {
+        const char *suffix = entries[i].is_dir ? "/" : "";
+        listing_append(out, "            <li><a href=\"./");
+        listing_append_uri_encoded(out, entries[i].name);
+        listing_append(out, suffix);
+        listing_append(out, "\">");
+        listing_append_escaped(out, entries[i].name);
+        listing_append(out, suffix);
+        listing_append(out, "</a></li>\n");
+    }
+    listing_append(out, "        </ul>\n    </body>\n</html>\n");
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const dir_entry_t *)a)->name, ((const dir_entry_t *)b)->name);
+}
+
+static void listing_append(listing_t *out, const char *str) {
+    listing_append_len(out, str, strlen(str));
+}
+
+static void listing_append_len(listing_t *out, const char *str, size_t len) {
+    if (out->is_failed) {
+        return;
+    }
+    if (out->len + len > out->cap) {
+        size_t cap = out->cap == 0 ? LISTING_INITIAL_SIZE : out->cap;
+        while (out->len + len > cap) {
+            cap *= 2;
+        }
+        char *grown = realloc(out->buf, cap);
+        if (grown == NULL) {
+            out->is_failed = true;
+            return;
+        }
+        out->buf = grown;
+        out->cap = cap;
+    }
+    memcpy(out->buf + out->len, str, len);
+    out->len += len;
+}
+
+// Appends a file name or path, escaping the characters which HTML gives a meaning to in text and attribute values.
+static void listing_append_escaped(listing_t *out, const char *str) {
+    while (*str != '\0') {
+        // Copy the run of characters up to the next one needing an escape in one go.
+        size_t plain_len = strcspn(str, "&<>\"'");
+        listing_append_len(out, str, plain_len);
+        str += plain_len;
+        switch (*str) {
+        case '&':
+            listing_append(out, "&amp;");
+            break;
+        case '<':
+            listing_append(out, "&lt;");
+            break;
+        case '>':
+            listing_append(out, "&gt;");
+            break;
+        case '"':
+            listing_append(out, "&quot;");
+            break;
+        case '\'':
+            listing_append(out, "&#39;");
+            break;
+        default:
+            // The end of the string.
+            return;
+        }
+        str++;
+    }
+}
+
+// Appends a file name as a URI path segment, percent-encoding every byte but the unreserved characters of RFC 3986,
+// which leaves nothing HTML gives a meaning to either. The server decodes the escapes in requests.
+static void listing_append_uri_encoded(listing_t *out, const char *str) {
+    static const char hex_digits[] = "0123456789ABCDEF";
+    while (*str != '\0') {
+        size_t plain_len = strspn(str, URI_UNRESERVED);
+        listing_append_len(out, str, plain_len);
+        str += plain_len;
+        if (*str == '\0') {
+            return;
+        }
+        unsigned char c = *str++;
+        char escape[3] = {'%', hex_digits[c >> 4], hex_digits[c & 0xf]};
+        listing_append_len(out, escape, sizeof(escape));
+    }
+}
+
+static void free_page(autoindex_page_t *page) {
+    free(page->dir_path);
+    free(page->body);
+    free(page);
+}
@@ -0,0 +1,41 @@
+#ifndef AUTOINDEX_H
+#define AUTOINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "header.h"
+
+// Cached HTML listings of directories without an index.html. A listing is rendered once per directory and kept in
+// memory, keyed by the directory's path and checked against its mtime on every request, which changes whenever an
+// entry is added, removed or renamed. Repeated requests therefore cost one open() and fstat() of the directory rather
+// than a readdir() and render. Listings are reference counted, so a listing being sent stays valid while a newer one
+// replaces it in the cache.
+
+// Power of two. The cache is direct-mapped, so a directory whose slot is taken replaces the previous listing.
+#define AUTOINDEX_CACHE_SLOTS 256
+
+typedef struct autoindex_page_t {
+    char *dir_path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    // Guarded by the cache's lock. The cache holds one reference while the page is in it.
+    unsigned long refs;
+    // The representation part of the listing's 200 header, see header.h.
+    char header[HEADER_REPRESENTATION_MAX];
+    size_t header_len;
+    char *body;
+    size_t body_len;
+} autoindex_page_t;
+
+// Gets the listing of the directory at dir_path, requested as uri (which ends in '/'), rendering it if it is not cached
+// or the directory has changed since. Returns NULL if dir_path is not a readable directory. Release the page with
+// autoindex_release() once sent.
+autoindex_page_t *autoindex_get(const char *dir_path, const char *uri);
+
+void autoindex_release(autoindex_page_t *page);
+
+#endif // !AUTOINDEX_H
@@ -0,0 +1,81 @@
+# Benchmark comparing small-file requests over TCP loopback against a unix domain socket listener.
+
+import os
+import signal
+import socket
+import subprocess
+import time
+
+from test_env import *
+
+UNIX_PATH: str = "/tmp/http-server-bench.sock"
+REQUESTS: int = 5000
+WARMUP_REQUESTS: int = 200
+FILES = ["/index.html", "/assets/styles.css", "/assets/image.jpg"]
+
+
+def connect_tcp() -> socket.socket:
+    family = socket.AF_INET6 if IP_VER == 6 else socket.AF_INET
+    addr = "::1" if IP_VER == 6 else "127.0.0.1"
+    sock = socket.socket(family, socket.SOCK_STREAM)
+    sock.connect((addr, PORT))
+    return sock
+
+
+def connect_unix() -> socket.socket:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(UNIX_PATH)
+    return sock
+
+
+def fetch(connect, path: str) -> bytes:
+    """Makes one HTTP/1.0 request on a new connection, returning the whole response."""
+    sock = connect()
+    sock.sendall(("GET " + path + " HTTP/1.0\r\n\r\n").encode("ascii"))
+    chunks = []
+    while True:
+        chunk = sock.recv(65536)
+        if not chunk:
+            break
+        chunks.append(chunk)
+    sock.close()
+    return b"".join(chunks)
+
+
+def bench(connect, path: str, expected_size: int):
+    """Returns requests per second and p50/p99 latencies in microseconds for sequential requests."""
+    for _ in range(WARMUP_REQUESTS):
+        fetch(connect, path)
+
+    latencies = []
+    start = time.perf_counter()
+    for _ in range(REQUESTS):
+        t = time.perf_counter()
+        res = fetch(connect, path)
+        latencies.append(time.perf_counter() - t)
+        assert len(res.split(b"\r\n\r\n", 1)[1]) == expected_size
+    elapsed = time.perf_counter() - start
+
+    latencies.sort()
+    p50 = latencies[len(latencies) // 2] * 1e6
+    p99 = latencies[int(len(latencies) * 0.99)] * 1e6
+    return REQUESTS / elapsed, p50, p99
+
+
+def main():
+    server = subprocess.Popen([SERVER, "-u", UNIX_PATH, str(IP_VER), str(PORT), ROOT])
+    time.sleep(0.1)
+    try:
+        print(f"{'file':<22}{'listener':<10}{'req/s':>10}{'p50 us':>10}{'p99 us':>10}")
+        for path in FILES:
+            size = os.path.getsize(ROOT + path)
+            for name, connect in (("tcp", connect_tcp), ("unix", connect_unix)):
+                rps, p50, p99 = bench(connect, path, size)
+                print(f"{path:<22}{name:<10}{rps:>10.0f}{p50:>10.1f}{p99:>10.1f}")
+    finally:
+        server.send_signal(signal.SIGINT)
+        server.wait()
+
+
+if __name__ == "__main__":
+    main()
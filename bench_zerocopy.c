@@ -0,0 +1,167 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zerocopy.h"
+
+// Benchmark comparing copying send() against zerocopy_send() for in-memory buffers of increasing size, to find the
+// size above which MSG_ZEROCOPY pays for itself. Each buffer is sent and then waited on like one response body.
+//
+// With no arguments, bytes are sent over loopback to a forked sink. The kernel copies loopback traffic regardless
+// (which is why the server never requests zero-copy for loopback peers), so this only measures the overhead of
+// requesting it.
+// For the real comparison, run a sink on another host (e.g. `nc -l 9000 > /dev/null`) and pass its address.
+
+#define USAGE "usage: ./bench_zerocopy [host port]\n"
+#define BYTES_PER_RUN (512L * 1024 * 1024)
+#define MAX_SIZE (1024 * 1024)
+#define SINK_BUFFER_SIZE (1024 * 1024)
+// The sink reads continuously, so completions only take this long if it has stopped.
+#define WAIT_TIMEOUT_MS 10000
+
+static const size_t sizes[] = {4096, 8192, 16384, 32768, 65536, 262144, 1048576};
+
+// Function prototypes.
+int connect_to(const char *host, const char *port);
+int connect_to_forked_sink(pid_t *sink_pid);
+void run(int sockfd, const char *buf, size_t size, bool use_zerocopy);
+double seconds_of(struct timeval tv);
+
+int main(int argc, char *argv[]) {
+    if (argc != 1 && argc != 3) {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t sink_pid = -1;
+    int sockfd = argc == 3 ? connect_to(argv[1], argv[2]) : connect_to_forked_sink(&sink_pid);
+
+    char *buf = malloc(MAX_SIZE);
+    if (buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(buf, 'z', MAX_SIZE);
+
+    // Opt in here, so zerocopy_send() neither skips loopback nor falls back to copying after the first completion.
+    int enable = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt: SO_ZEROCOPY");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-10s%-10s%12s%14s\n", "size", "mode", "MB/s", "CPU us/MB");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        run(sockfd, buf, sizes[i], false);
+        run(sockfd, buf, sizes[i], true);
+    }
+
+    close(sockfd);
+    free(buf);
+    if (sink_pid > 0) {
+        waitpid(sink_pid, NULL, 0);
+    }
+    return 0;
+}
+
+// Connects to a sink which discards everything it reads.
+int connect_to(const char *host, const char *port) {
+    struct addrinfo hints = {0}, *res;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    int sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sockfd < 0 || connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    freeaddrinfo(res);
+    return sockfd;
+}
+
+// Forks a process which accepts one loopback connection and discards everything it reads, then connects to it.
+int connect_to_forked_sink(pid_t *sink_pid) {
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+    if (listenfd < 0 || bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 1) < 0 ||
+        getsockname(listenfd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("sink");
+        exit(EXIT_FAILURE);
+    }
+
+    *sink_pid = fork();
+    if (*sink_pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (*sink_pid == 0) {
+        int fd = accept(listenfd, NULL, NULL);
+        char *sink = malloc(SINK_BUFFER_SIZE);
+        while (fd >= 0 && sink != NULL && read(fd, sink, SINK_BUFFER_SIZE) > 0) {
+        }
+        _exit(0);
+    }
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    close(listenfd);
+    return sockfd;
+}
+
+// Sends BYTES_PER_RUN bytes as buffers of the given size, printing throughput and the sender's CPU time per MB.
+void run(int sockfd, const char *buf, size_t size, bool use_zerocopy) {
+    struct rusage usage_start, usage_end;
+    struct timespec start, end;
+    getrusage(RUSAGE_SELF, &usage_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long sent = 0; sent < BYTES_PER_RUN; sent += size) {
+        // A fresh state per buffer, as each response gets one.
+        zerocopy_t zc = ZEROCOPY_INIT;
+        zc.is_enabled = true;
+        size_t bytes_sent = 0;
+        while (bytes_sent < size) {
+            ssize_t n = use_zerocopy ? zerocopy_send(sockfd, buf + bytes_sent, size - bytes_sent, &zc)
+                                     : send(sockfd, buf + bytes_sent, size - bytes_sent, 0);
+            if (n < 0) {
+                perror("send");
+                exit(EXIT_FAILURE);
+            }
+            bytes_sent += n;
+        }
+        if (!zerocopy_wait(sockfd, &zc, WAIT_TIMEOUT_MS)) {
+            fprintf(stderr, "sink stopped reading.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &usage_end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double cpu = seconds_of(usage_end.ru_utime) - seconds_of(usage_start.ru_utime) + seconds_of(usage_end.ru_stime) -
+                 seconds_of(usage_start.ru_stime);
+    double mb = BYTES_PER_RUN / (1024.0 * 1024.0);
+    printf("%-10zu%-10s%12.0f%14.1f\n", size, use_zerocopy ? "zerocopy" : "copy", mb / elapsed, cpu * 1e6 / mb);
+}
+
+double seconds_of(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bundle.h"
+#include "header.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// A packed, immutable static-site bundle, memory-mapped by the server at startup.
+
+// Function prototypes.
+static bool bundle_range_valid(const bundle_t *bundle, uint64_t offset, uint64_t len);
+static bool bundle_validate(bundle_t *bundle);
+
+// FNV-1a: simple, fast for short strings, and well-distributed enough for a hash table at most half full.
+uint64_t bundle_hash(const char *path, size_t path_len) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < path_len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Opens and memory-maps a bundle. Returns NULL if the file is not a valid bundle.
+bundle_t *bundle_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open: bundle");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(bundle_header_t)) {
+        fprintf(stderr, "server: %s is not a bundle.\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // The whole bundle is mapped, but only the index is ever touched through the mapping: bodies are sent from the file
+    // descriptor with sendfile(), so they are only paged in by the kernel when sent.
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap: bundle");
+        close(fd);
+        return NULL;
+    }
+
+    bundle_t *bundle = malloc(sizeof(*bundle));
+    if (bundle == NULL) {
+        perror("malloc: bundle_open");
+        munmap(base, st.st_size);
+        close(fd);
+        return NULL;
+    }
+    bundle->fd = fd;
+    bundle->base = base;
+    bundle->size = st.st_size;
+    bundle->header = base;
+    bundle->slots = NULL;
+    bundle->entries = NULL;
+
+    if (!bundle_validate(bundle)) {
+        fprintf(stderr, "server: %s is not a valid bundle.\n", path);
+        bundle_close(bundle);
+        return NULL;
+    }
+    return bundle;
+}
+
+// Finds the entry for a normalised request path, with linear probing from the path's hash.
+const bundle_entry_t *bundle_lookup(const bundle_t *bundle, const char *path, size_t path_len) {
+    uint64_t hash = bundle_hash(path, path_len);
+    uint32_t mask = bundle->header->n_slots - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t slot = bundle->slots[i];
+        if (slot == BUNDLE_EMPTY_SLOT) {
+            return NULL;
+        }
+        const bundle_entry_t *entry = &bundle->entries[slot];
+        if (entry->hash == hash && entry->path_len == path_len &&
+            memcmp(bundle->base + entry->path_offset, path, path_len) == 0) {
+            return entry;
+        }
+    }
+}
+
+void bundle_close(bundle_t *bundle) {
+    if (bundle == NULL) {
+        return;
+    }
+    munmap((void *)bundle->base, bundle->size);
+    close(bundle->fd);
+    free(bundle);
+}
+
+// True if [offset, offset + len) lies within the bundle, without overflowing.
+static bool bundle_range_valid(const bundle_t *bundle, uint64_t offset, uint64_t len) {
+    return offset <= bundle->size && len <= bundle->size - offset;
+}
+
+// Checks every offset in the index once at startup, so a truncated or corrupt bundle is rejected up front.
+static bool bundle_validate(bundle_t *bundle) {
+    const bundle_header_t *header = bundle->header;
+    if (memcmp(header->magic, BUNDLE_MAGIC, BUNDLE_MAGIC_LEN) != 0 || header->version != BUNDLE_VERSION) {
+        return false;
+    }
+    // A power-of-two table with at least one empty slot, so that probing always terminates.
+    if (header->n_slots == 0 || (header->n_slots & (header->n_slots - 1)) != 0 ||
+        header->n_entries >= header->n_slots) {
+        return false;
+    }
+    if (header->slots_offset % sizeof(uint32_t) != 0 || header->entries_offset % sizeof(uint64_t) != 0 ||
+        !bundle_range_valid(bundle, header->slots_offset, (uint64_t)header->n_slots * sizeof(uint32_t)) ||
+        !bundle_range_valid(bundle, header->entries_offset, (uint64_t)header->n_entries * sizeof(bundle_entry_t))) {
+        return false;
+    }
+    bundle->slots = (const uint32_t *)(bundle->base + header->slots_offset);
+    bundle->entries = (const bundle_entry_t *)(bundle->base + header->entries_offset);
+
+    for (uint32_t i = 0; i < header->n_slots; i++) {
+        if (bundle->slots[i] != BUNDLE_EMPTY_SLOT && bundle->slots[i] >= header->n_entries) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->n_entries; i++) {
+        const bundle_entry_t *entry = &bundle->entries[i];
+        if (!bundle_range_valid(bundle, entry->path_offset, entry->path_len) ||
+            !bundle_range_valid(bundle, entry->header_offset, entry->header_len) ||
+            entry->header_len > HEADER_REPRESENTATION_MAX ||
+            !bundle_range_valid(bundle, entry->body_offset, entry->body_size)) {
+            return false;
+        }
+    }
+    return true;
+}
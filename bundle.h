@@ -0,0 +1,63 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A packed, immutable static-site bundle: a whole web root compiled by ./pack into a single file, which the server
+// memory-maps at startup. Lookups are in-memory hash probes, and bodies are sent with sendfile() from the bundle's file
+// descriptor at their offsets, so no files are opened or stat'd per request. Deploying a new site is an atomic rename
+// of a new bundle over the old one, followed by a restart.
+//
+// Layout, in native byte order: bundle_header_t, the hash table of slots, the entries, then the request paths and
+// the precomputed representation part of each 200 header (see header.h), and finally each body aligned to BUNDLE_ALIGN.
+
+#define BUNDLE_MAGIC "HTTPBNDL"
+#define BUNDLE_MAGIC_LEN 8
+#define BUNDLE_VERSION 2
+#define BUNDLE_ALIGN 4096
+#define BUNDLE_EMPTY_SLOT UINT32_MAX
+
+typedef struct bundle_header_t {
+    char magic[BUNDLE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t n_entries;
+    // Number of hash table slots, a power of two. Each slot is an index into the entries, or BUNDLE_EMPTY_SLOT.
+    uint32_t n_slots;
+    uint32_t reserved;
+    uint64_t slots_offset;
+    uint64_t entries_offset;
+} bundle_header_t;
+
+typedef struct bundle_entry_t {
+    uint64_t hash;
+    uint64_t path_offset;
+    uint64_t header_offset;
+    uint64_t body_offset;
+    uint64_t body_size;
+    uint32_t path_len;
+    uint32_t header_len;
+} bundle_entry_t;
+
+// A memory-mapped bundle, validated on opening so that lookups can trust every offset.
+typedef struct bundle_t {
+    int fd;
+    const unsigned char *base;
+    size_t size;
+    const bundle_header_t *header;
+    const uint32_t *slots;
+    const bundle_entry_t *entries;
+} bundle_t;
+
+// FNV-1a hash of a request path, shared by ./pack and the server.
+uint64_t bundle_hash(const char *path, size_t path_len);
+
+// Opens and memory-maps a bundle. Returns NULL if the file is not a valid bundle.
+bundle_t *bundle_open(const char *path);
+
+// Finds the entry for a normalised request path, or NULL if it is not in the bundle.
+const bundle_entry_t *bundle_lookup(const bundle_t *bundle, const char *path, size_t path_len);
+
+void bundle_close(bundle_t *bundle);
+
+#endif // !BUNDLE_H
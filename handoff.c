@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "handoff.h"
+
+#define ENV_ENTRY_SIZE 48
+#define SELF_EXE_LINK "/proc/self/exe"
+
+// Listening socket handoff between an old and a new server process, used for zero-downtime restarts.
+
+extern char **environ;
+
+// Function prototypes.
+static char **environ_with_handoff_fd(char *entry, size_t entry_size, int fd);
+
+// Resolves the absolute path of the running server binary. argv[0] cannot be executed directly: it may have been found
+// through PATH, which execv() does not search, or be relative to a working directory which has since changed. The
+// link is read once at startup, since after a new build replaces the binary it names the deleted old file instead.
+char *handoff_exe_path() {
+    static char path[PATH_MAX];
+    ssize_t len = readlink(SELF_EXE_LINK, path, sizeof(path) - 1);
+    if (len < 0) {
+        perror("readlink: handoff");
+        exit(EXIT_FAILURE);
+    }
+    path[len] = '\0';
+    return path;
+}
+
+// Re-executes the server binary at exe_path with argv, passing it one end of a socketpair through HANDOFF_ENV.
+int handoff_spawn(const char *exe_path, char *const argv[], pid_t *pid_dest) {
+    // Both ends are close-on-exec, except the end which is deliberately inherited by the new binary.
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        perror("socketpair: handoff");
+        return -1;
+    }
+    if (fcntl(pair[1], F_SETFD, 0) < 0) {
+        perror("fcntl: handoff");
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    // The new process's environment is a copy prepared before forking, since only async-signal-safe calls may be made
+    // in the child of a multithreaded process, and setenv() is not thread-safe while worker threads run.
+    char entry[ENV_ENTRY_SIZE];
+    char **envp = environ_with_handoff_fd(entry, sizeof(entry), pair[1]);
+    if (envp == NULL) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        execve(exe_path, argv, envp);
+        _exit(EXIT_FAILURE);
+    }
+    free(envp);
+    close(pair[1]);
+
+    if (pid < 0) {
+        perror("fork: handoff");
+        close(pair[0]);
+        return -1;
+    }
+    *pid_dest = pid;
+    return pair[0];
+}
+
+// Sends n_fds listening sockets to the peer process. The number of sockets is sent as the single data byte, since
+// SCM_RIGHTS ancillary data must accompany at least one byte of regular data.
+int handoff_send_fds(int sockfd, const int *fds, size_t n_fds) {
+    if (n_fds == 0 || n_fds > HANDOFF_MAX_FDS) {
+        return -1;
+    }
+    uint8_t count = (uint8_t)n_fds;
+    struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+
+    // Control buffer is a union to guarantee the alignment required by struct cmsghdr.
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+
+    if (sendmsg(sockfd, &msg, 0) < 0) {
+        perror("sendmsg: handoff");
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the handoff socket inherited from a previous server process, or -1 if this process was started normally.
+int handoff_inherited_fd() {
+    const char *fd_str = getenv(HANDOFF_ENV);
+    if (fd_str == NULL) {
+        return -1;
+    }
+
+    errno = 0;
+    char *endptr;
+    long fd = strtol(fd_str, &endptr, 10);
+    // Safe to modify the environment here, since this runs at startup before any threads exist.
+    unsetenv(HANDOFF_ENV);
+    if (errno != 0 || endptr == fd_str || *endptr != '\0' || fd < 0) {
+        fprintf(stderr, "server: ignoring malformed %s.\n", HANDOFF_ENV);
+        return -1;
+    }
+
+    // Keep the handoff socket from leaking into any further restarts.
+    if (fcntl((int)fd, F_SETFD, FD_CLOEXEC) < 0) {
+        perror("fcntl: handoff");
+        return -1;
+    }
+    return (int)fd;
+}
+
+// Receives up to max_fds listening sockets from the previous server process.
+int handoff_recv_fds(int sockfd, int *fds_dest, size_t max_fds) {
+    uint8_t count = 0;
+    struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        perror("recvmsg: handoff");
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        (msg.msg_flags & MSG_CTRUNC)) {
+        fprintf(stderr, "server: handoff did not contain listening sockets.\n");
+        return -1;
+    }
+    size_t n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (n_fds != count || n_fds > max_fds) {
+        fprintf(stderr, "server: handoff contained an unexpected number of listening sockets.\n");
+        return -1;
+    }
+    memcpy(fds_dest, CMSG_DATA(cmsg), sizeof(int) * n_fds);
+    return (int)n_fds;
+}
+
+// Tells the previous server process that this process is accepting, and closes the handoff socket.
+void handoff_send_ready(int sockfd) {
+    const char ready = HANDOFF_READY;
+    if (send(sockfd, &ready, sizeof(ready), MSG_NOSIGNAL) < 0) {
+        perror("send: handoff");
+    }
+    close(sockfd);
+}
+
+// Copies the environment's entries into a new array, replacing any HANDOFF_ENV entry with one for fd, which is written
+// into entry. Only the array is allocated: the entries are shared with environ. Returns NULL on failure.
+static char **environ_with_handoff_fd(char *entry, size_t entry_size, int fd) {
+    snprintf(entry, entry_size, "%s=%d", HANDOFF_ENV, fd);
+    size_t name_len = strlen(HANDOFF_ENV);
+    size_t n_entries = 0;
+    while (environ[n_entries] != NULL) {
+        n_entries++;
+    }
+
+    char **envp = malloc(sizeof(*envp) * (n_entries + 2));
+    if (envp == NULL) {
+        perror("malloc: handoff");
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < n_entries; i++) {
+        if (strncmp(environ[i], HANDOFF_ENV, name_len) != 0 || environ[i][name_len] != '=') {
+            envp[n++] = environ[i];
+        }
+    }
+    envp[n++] = entry;
+    envp[n] = NULL;
+    return envp;
+}
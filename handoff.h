@@ -0,0 +1,38 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Listening socket handoff between an old and a new server process, used for zero-downtime restarts. The old process
+// re-executes the server binary with one end of a unix socketpair, then passes its listening sockets across with
+// SCM_RIGHTS. The new process acknowledges once it is ready to accept, after which the old process stops accepting and
+// drains. Since the listening sockets are never closed in between, no connection is refused during a restart.
+
+#define HANDOFF_ENV "SERVER_HANDOFF_FD"
+#define HANDOFF_MAX_FDS 4
+#define HANDOFF_READY 'R'
+
+// Resolves the absolute path of the running server binary, through /proc/self/exe. Call at startup, before the binary
+// can be replaced. Exits on failure.
+char *handoff_exe_path();
+
+// Re-executes the server binary at exe_path with argv, passing it one end of a socketpair through HANDOFF_ENV. Returns
+// the other end for the caller to use, or -1 on failure. The child's pid is written to pid_dest.
+int handoff_spawn(const char *exe_path, char *const argv[], pid_t *pid_dest);
+
+// Sends n_fds listening sockets to the peer process. Returns 0 on success, -1 on failure.
+int handoff_send_fds(int sockfd, const int *fds, size_t n_fds);
+
+// Returns the handoff socket inherited from a previous server process, or -1 if this process was started normally.
+// Call at startup, before any threads exist, since it modifies the environment.
+int handoff_inherited_fd();
+
+// Receives up to max_fds listening sockets from the previous server process. Returns the number received, or -1 on
+// failure.
+int handoff_recv_fds(int sockfd, int *fds_dest, size_t max_fds);
+
+// Tells the previous server process that this process is accepting, and closes the handoff socket.
+void handoff_send_ready(int sockfd);
+
+#endif // !HANDOFF_H
@@ -0,0 +1,239 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "header.h"
+
+#define HTTP_VERSION "HTTP/1.0"
+#define CRLF "\r\n"
+#define STATUS_200 HTTP_VERSION " 200 OK" CRLF
+#define CLENGTH_PREFIX "Content-Length: "
+#define CLENGTH_EMPTY "Content-Length: 0" CRLF
+#define CTYPE_PREFIX "Content-Type: "
+#define LAST_MODIFIED_PREFIX "Last-Modified: "
+#define ETAG_PREFIX "ETag: \""
+#define ETAG_SUFFIX "\"" CRLF
+#define DATE_PREFIX "Date: "
+#define SERVER_AND_CONNECTION "Server: http-server" CRLF "Connection: close" CRLF
+#define CACHE_CONTROL_PREFIX "Cache-Control: "
+#define HTTP_DATE_LEN 29
+#define SECS_PER_DAY 86400
+#define MAX_CACHE_POLICIES 32
+#define MAX_EXTENSION_LEN 16
+#define EXTENSION_ANY "*"
+
+// Pre-rendered response header engine.
+
+// Appends a string literal, whose length is known at compile time.
+#define APPEND_LITERAL(dst, literal)                                                                                   \
+    do {                                                                                                               \
+        memcpy((dst), (literal), sizeof(literal) - 1);                                                                 \
+        (dst) += sizeof(literal) - 1;                                                                                  \
+    } while (0)
+
+typedef struct cache_policy_t {
+    char extension[MAX_EXTENSION_LEN + 1];
+    char policy[HEADER_CACHE_POLICY_MAX + 1];
+} cache_policy_t;
+
+static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                  "8081828384858687888990919293949596979899";
+static const char day_names[] = "SunMonTueWedThuFriSat";
+static const char month_names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+// The Date header value, regenerated when the second changes. Each thread keeps its own, so that client threads never
+// contend for it.
+static __thread time_t date_cached_secs = -1;
+static __thread char date_cached[HTTP_DATE_LEN];
+
+static cache_policy_t cache_policies[MAX_CACHE_POLICIES];
+static int n_cache_policies = 0;
+static const char *cache_policy_default = NULL;
+
+// Function prototypes.
+static char *append_str(char *dst, const char *str);
+static char *append_uint(char *dst, uint64_t val);
+static char *append_2_digits(char *dst, unsigned val);
+static void format_http_date(char *dst, time_t t);
+static char *append_date(char *dst);
+
+// Writes the representation part of a 200 header, returning its length.
+size_t header_begin_200(char *buf, off_t body_size, const char *mime, time_t last_modified, const char *etag) {
+    char *dst = buf;
+    APPEND_LITERAL(dst, STATUS_200);
+    APPEND_LITERAL(dst, CLENGTH_PREFIX);
+    dst = append_uint(dst, (uint64_t)body_size);
+    APPEND_LITERAL(dst, CRLF);
+    APPEND_LITERAL(dst, CTYPE_PREFIX);
+    dst = append_str(dst, mime);
+    APPEND_LITERAL(dst, CRLF);
+    if (last_modified >= 0) {
+        APPEND_LITERAL(dst, LAST_MODIFIED_PREFIX);
+        format_http_date(dst, last_modified);
+        dst += HTTP_DATE_LEN;
+        APPEND_LITERAL(dst, CRLF);
+    }
+    if (etag != NULL) {
+        APPEND_LITERAL(dst, ETAG_PREFIX);
+        dst = append_str(dst, etag);
+        APPEND_LITERAL(dst, ETAG_SUFFIX);
+    }
+    return dst - buf;
+}
+
+// Writes the representation part of a header with an empty body, returning its length.
+size_t header_begin_empty(char *buf, const char *status) {
+    char *dst = buf;
+    APPEND_LITERAL(dst, HTTP_VERSION " ");
+    dst = append_str(dst, status);
+    APPEND_LITERAL(dst, CRLF);
+    APPEND_LITERAL(dst, CLENGTH_EMPTY);
+    return dst - buf;
+}
+
+// Appends the per-response part and the blank line, returning the total length.
+size_t header_finish(char *buf, size_t len, const char *cache_control) {
+    char *dst = buf + len;
+    APPEND_LITERAL(dst, DATE_PREFIX);
+    dst = append_date(dst);
+    APPEND_LITERAL(dst, CRLF);
+    APPEND_LITERAL(dst, SERVER_AND_CONNECTION);
+    if (cache_control != NULL) {
+        APPEND_LITERAL(dst, CACHE_CONTROL_PREFIX);
+        dst = append_str(dst, cache_control);
+        APPEND_LITERAL(dst, CRLF);
+    }
+    APPEND_LITERAL(dst, CRLF);
+    return dst - buf;
+}
+
+// Adds a Cache-Control policy for request paths with an extension, from a rule such as ".css=max-age=86400".
+bool header_add_cache_policy(const char *rule) {
+    const char *equals = strchr(rule, '=');
+    if (equals == NULL || n_cache_policies == MAX_CACHE_POLICIES) {
+        return false;
+    }
+    size_t extension_len = equals - rule;
+    const char *policy = equals + 1;
+    size_t policy_len = strlen(policy);
+    bool is_any = extension_len == strlen(EXTENSION_ANY) && strncmp(rule, EXTENSION_ANY, extension_len) == 0;
+    if ((!is_any && (extension_len < 2 || rule[0] != '.')) || extension_len > MAX_EXTENSION_LEN ||
+        memchr(rule, '/', extension_len) != NULL || policy_len == 0 || policy_len > HEADER_CACHE_POLICY_MAX) {
+        return false;
+    }
+    // The policy is written into headers verbatim, so must not be able to end the field early.
+    for (size_t i = 0; i < policy_len; i++) {
+        if (policy[i] < ' ' || policy[i] == 0x7f) {
+            return false;
+        }
+    }
+
+    cache_policy_t *entry = &cache_policies[n_cache_policies++];
+    memcpy(entry->extension, rule, extension_len);
+    entry->extension[extension_len] = '\0';
+    memcpy(entry->policy, policy, policy_len + 1);
+    if (is_any) {
+        cache_policy_default = entry->policy;
+    }
+    return true;
+}
+
+// Gets the Cache-Control policy for a request path, or NULL if none applies. Later rules for the same extension win.
+const char *header_cache_policy(const char *uri) {
+    const char *last_slash = strrchr(uri, '/');
+    const char *last_dot = strrchr(uri, '.');
+    if (last_dot != NULL && (last_slash == NULL || last_slash < last_dot)) {
+        for (int i = n_cache_policies - 1; i >= 0; i--) {
+            if (strcmp(cache_policies[i].extension, last_dot) == 0) {
+                return cache_policies[i].policy;
+            }
+        }
+    }
+    return cache_policy_default;
+}
+
+static char *append_str(char *dst, const char *str) {
+    size_t len = strlen(str);
+    memcpy(dst, str, len);
+    return dst + len;
+}
+
+// Writes an integer in decimal two digits at a time, from a table rather than dividing for every digit.
+static char *append_uint(char *dst, uint64_t val) {
+    char digits[20];
+    char *p = digits + sizeof(digits);
+    while (val >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + (val % 100) * 2, 2);
+        val /= 100;
+    }
+    if (val >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + val * 2, 2);
+    } else {
+        *--p = '0' + val;
+    }
+    size_t len = digits + sizeof(digits) - p;
+    memcpy(dst, p, len);
+    return dst + len;
+}
+
+static char *append_2_digits(char *dst, unsigned val) {
+    memcpy(dst, digit_pairs + val * 2, 2);
+    return dst + 2;
+}
+
+// Formats an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT", which is always HTTP_DATE_LEN bytes. Converts
+// days since the epoch to a civil date directly (Howard Hinnant's civil_from_days), avoiding gmtime_r()'s locking and
+// time zone handling. Times before the epoch are clamped to it.
+static void format_http_date(char *dst, time_t t) {
+    if (t < 0) {
+        t = 0;
+    }
+    int64_t days = t / SECS_PER_DAY;
+    unsigned secs = t % SECS_PER_DAY;
+    unsigned weekday = (days + 4) % 7;
+
+    days += 719468;
+    int64_t era = days / 146097;
+    unsigned day_of_era = days - era * 146097;
+    unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    unsigned month_index = (5 * day_of_year + 2) / 153;
+    unsigned day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    unsigned month = month_index < 10 ? month_index + 3 : month_index - 9;
+    int64_t year = year_of_era + era * 400 + (month <= 2);
+    if (year > 9999) {
+        year = 9999;
+    }
+
+    memcpy(dst, day_names + weekday * 3, 3);
+    dst[3] = ',';
+    dst[4] = ' ';
+    dst = append_2_digits(dst + 5, day);
+    *dst++ = ' ';
+    memcpy(dst, month_names + (month - 1) * 3, 3);
+    dst[3] = ' ';
+    dst = append_2_digits(dst + 4, year / 100);
+    dst = append_2_digits(dst, year % 100);
+    *dst++ = ' ';
+    dst = append_2_digits(dst, secs / 3600);
+    *dst++ = ':';
+    dst = append_2_digits(dst, secs / 60 % 60);
+    *dst++ = ':';
+    dst = append_2_digits(dst, secs % 60);
+    memcpy(dst, " GMT", 4);
+}
+
+// Appends the current date, formatting it only for the thread's first response in each second.
+static char *append_date(char *dst) {
+    time_t now = time(NULL);
+    if (now != date_cached_secs) {
+        format_http_date(date_cached, now);
+        date_cached_secs = now;
+    }
+    memcpy(dst, date_cached, HTTP_DATE_LEN);
+    return dst + HTTP_DATE_LEN;
+}
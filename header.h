@@ -0,0 +1,41 @@
+#ifndef HEADER_H
+#define HEADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Pre-rendered response header engine. Headers are assembled into a caller-provided buffer by copying constant
+// fragments and writing integers directly, without snprintf() or allocations. Headers are split in two parts:
+//
+// - The representation part: the status line and the fields describing the body (Content-Length, Content-Type,
+//   Last-Modified, ETag). It depends only on the file, so ./pack precomputes it for every file in a bundle.
+// - The per-response part, appended by header_finish(): Date, Server, Connection and Cache-Control, then the blank
+//   line ending the header. Date is formatted at most once per second per thread.
+
+// Enough for any header built here, given a representation part of at most HEADER_REPRESENTATION_MAX bytes.
+#define HEADER_BUFFER_SIZE 1024
+#define HEADER_REPRESENTATION_MAX 512
+#define HEADER_CACHE_POLICY_MAX 128
+
+// Writes the representation part of a 200 header, returning its length. last_modified is omitted if negative, and
+// etag if NULL. mime and etag must be short enough to fit within HEADER_REPRESENTATION_MAX.
+size_t header_begin_200(char *buf, off_t body_size, const char *mime, time_t last_modified, const char *etag);
+
+// Writes the representation part of a header with an empty body, e.g. "404 Not Found", returning its length.
+size_t header_begin_empty(char *buf, const char *status);
+
+// Appends the per-response part and the blank line to a representation part of len bytes, returning the total length.
+// cache_control is omitted if NULL.
+size_t header_finish(char *buf, size_t len, const char *cache_control);
+
+// Adds a Cache-Control policy for request paths with an extension, from a rule such as ".css=max-age=86400". An
+// extension of "*" applies to paths matching no other rule. Called before any client threads exist. Returns false if
+// the rule is malformed or there are too many rules.
+bool header_add_cache_policy(const char *rule);
+
+// Gets the Cache-Control policy for a request path, or NULL if none applies.
+const char *header_cache_policy(const char *uri);
+
+#endif // !HEADER_H
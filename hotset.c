@@ -0,0 +1,186 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "bundle.h"
+#include "hotset.h"
+#include "http.h"
+
+// Power of two. At most half of the slots are filled, after which new paths are no longer counted.
+#define HOTSET_CAPACITY 8192
+#define HOTSET_SAVE_MAX 1024
+#define HOTSET_WARM_MAX_BYTES (1LL << 30)
+#define MANIFEST_LINE_SIZE (PATH_MAX + 2)
+#define MANIFEST_COMMENT '#'
+#define TMP_SUFFIX ".tmp"
+#define MS_PER_SEC 1000L
+#define NS_PER_MS 1000000L
+
+// Startup cache warm-up from a manifest of hot paths.
+
+typedef struct hotset_slot_t {
+    char *uri;
+    unsigned long count;
+} hotset_slot_t;
+
+// Request counts, in an open-addressed hash table keyed by path.
+static hotset_slot_t slots[HOTSET_CAPACITY];
+static size_t n_paths = 0;
+static bool is_recording = false;
+static pthread_mutex_t hotset_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function prototypes.
+static void hotset_add(const char *uri, size_t uri_len, unsigned long increment);
+static int compare_counts(const void *a, const void *b);
+static long elapsed_ms(const struct timespec *start);
+
+// Begins counting requests per path. Called before any client threads exist.
+void hotset_start_recording() {
+    is_recording = true;
+}
+
+// Counts a request for a path which was served with a 200.
+void hotset_record(const char *uri, size_t uri_len) {
+    if (is_recording) {
+        hotset_add(uri, uri_len, 1);
+    }
+}
+
+// Adds increment to a path's count, adding the path if it is new.
+static void hotset_add(const char *uri, size_t uri_len, unsigned long increment) {
+    // Hash outside the lock, with the same hash as bundle lookups.
+    uint64_t hash = bundle_hash(uri, uri_len);
+    pthread_mutex_lock(&hotset_lock);
+    for (size_t i = hash & (HOTSET_CAPACITY - 1);; i = (i + 1) & (HOTSET_CAPACITY - 1)) {
+        if (slots[i].uri == NULL) {
+            // New path: count it only while the table is at most half full, keeping probe sequences short.
+            if (n_paths < HOTSET_CAPACITY / 2) {
+                slots[i].uri = strndup(uri, uri_len);
+                if (slots[i].uri != NULL) {
+                    slots[i].count = increment;
+                    n_paths++;
+                }
+            }
+            break;
+        }
+        if (strncmp(slots[i].uri, uri, uri_len) == 0 && slots[i].uri[uri_len] == '\0') {
+            slots[i].count += increment;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hotset_lock);
+}
+
+// Writes the hottest recorded paths to the manifest, hottest first, replacing it atomically.
+void hotset_save(const char *manifest_path) {
+    if (!is_recording) {
+        return;
+    }
+
+    // Snapshot the counts under the lock, then sort and write without holding it.
+    hotset_slot_t *hottest = malloc(sizeof(*hottest) * (HOTSET_CAPACITY / 2));
+    if (hottest == NULL) {
+        perror("malloc: hotset_save");
+        return;
+    }
+    size_t n = 0;
+    pthread_mutex_lock(&hotset_lock);
+    for (size_t i = 0; i < HOTSET_CAPACITY; i++) {
+        if (slots[i].uri != NULL) {
+            hottest[n++] = slots[i];
+        }
+    }
+    pthread_mutex_unlock(&hotset_lock);
+    qsort(hottest, n, sizeof(*hottest), compare_counts);
+
+    // Paths are never freed while recording, so the snapshot's strings remain valid.
+    char *tmp_path = malloc(strlen(manifest_path) + sizeof(TMP_SUFFIX));
+    if (tmp_path == NULL) {
+        perror("malloc: hotset_save");
+        free(hottest);
+        return;
+    }
+    strcpy(tmp_path, manifest_path);
+    strcat(tmp_path, TMP_SUFFIX);
+    FILE *manifest = fopen(tmp_path, "w");
+    if (manifest == NULL) {
+        perror("fopen: hot-set manifest");
+    } else {
+        for (size_t i = 0; i < n && i < HOTSET_SAVE_MAX; i++) {
+            fprintf(manifest, "%s\n", hottest[i].uri);
+        }
+        if (fclose(manifest) != 0 || rename(tmp_path, manifest_path) != 0) {
+            perror("hot-set manifest");
+        } else {
+            fprintf(stderr, "server: saved %zu hot paths to %s.\n", n < HOTSET_SAVE_MAX ? n : HOTSET_SAVE_MAX,
+                    manifest_path);
+        }
+    }
+    free(tmp_path);
+    free(hottest);
+}
+
+// Prefetches the paths listed in the manifest, hottest first, stopping once budget_ms has elapsed or
+// HOTSET_WARM_MAX_BYTES have been prefetched. A missing manifest is not an error, e.g. on the very first startup.
+void hotset_warm(const char *manifest_path, unsigned long budget_ms, const char *path_root, bool is_autoindex,
+                 const bundle_t *bundle) {
+    FILE *manifest = fopen(manifest_path, "r");
+    if (manifest == NULL) {
+        fprintf(stderr, "server: no hot-set manifest at %s, skipping warm-up.\n", manifest_path);
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char line[MANIFEST_LINE_SIZE];
+    unsigned long n_warmed = 0, n_missing = 0;
+    long long bytes_warmed = 0;
+    bool is_over_budget = false;
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        if (elapsed_ms(&start) >= (long)budget_ms || bytes_warmed >= HOTSET_WARM_MAX_BYTES) {
+            is_over_budget = true;
+            break;
+        }
+
+        // Manifests may also be written by hand: skip blank lines and comments.
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == MANIFEST_COMMENT) {
+            continue;
+        }
+        off_t size = prefetch_uri(path_root, is_autoindex, bundle, line);
+        if (size < 0) {
+            n_missing++;
+            continue;
+        }
+        n_warmed++;
+        bytes_warmed += size;
+
+        // Carry warmed paths over into the next manifest, after any paths actually requested during this run.
+        if (is_recording) {
+            hotset_add(line, strlen(line), 0);
+        }
+    }
+    fclose(manifest);
+
+    fprintf(stderr, "server: warm-up prefetched %lu paths (%lld bytes) in %ld ms, %lu not found%s.\n", n_warmed,
+            bytes_warmed, elapsed_ms(&start), n_missing, is_over_budget ? ", stopped at budget" : "");
+}
+
+// Sorts hottest first.
+static int compare_counts(const void *a, const void *b) {
+    unsigned long count_a = ((const hotset_slot_t *)a)->count;
+    unsigned long count_b = ((const hotset_slot_t *)b)->count;
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * MS_PER_SEC + (now.tv_nsec - start->tv_nsec) / NS_PER_MS;
+}
@@ -0,0 +1,28 @@
+#ifndef HOTSET_H
+#define HOTSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bundle.h"
+
+// Startup cache warm-up from a manifest of hot paths. While serving, 200 responses are counted per path, and the
+// hottest paths are saved to the manifest before the server shuts down or restarts. At the next startup, the manifest
+// is read back and each path's body is prefetched into the page cache before the server begins listening, so the first
+// minutes of traffic after a restart do not pay cold cache misses.
+
+// Begins counting requests per path, to be saved with hotset_save().
+void hotset_start_recording();
+
+// Counts a request for a path which was served with a 200. Does nothing unless recording.
+void hotset_record(const char *uri, size_t uri_len);
+
+// Writes the hottest recorded paths to the manifest, hottest first, replacing it atomically.
+void hotset_save(const char *manifest_path);
+
+// Prefetches the paths listed in the manifest, hottest first, stopping once budget_ms has elapsed. With is_autoindex,
+// directories without an index.html have their listings rendered into the autoindex cache instead.
+void hotset_warm(const char *manifest_path, unsigned long budget_ms, const char *path_root, bool is_autoindex,
+                 const bundle_t *bundle);
+
+#endif // !HOTSET_H
@@ -7,6 +7,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "autoindex.h"
+#include "bundle.h"
+#include "header.h"
+#include "hotset.h"
 #include "http.h"
 #include "response.h"
 
@@ -24,7 +28,10 @@
 #define PATH_ESCAPE_TRAILING "/.."
 #define PATH_ESCAPE_TRAILING_LEN 3
 #define SLASH_CHAR '/'
+#define PERCENT_CHAR '%'
 #define DOT_CHAR '.'
+#define INDEX_FILE "index.html"
+#define INDEX_FILE_LEN 10
 
 // A HTTP Request parsing, processing, local file handling, and response construction library.
 
@@ -35,9 +42,13 @@ const char mime_default[] = "application/octet-stream";
 
 // Function prototypes
 int get_request_uri(const request_t *req, char **uri_dest);
+int decode_uri(char *uri, int uri_len);
+int hex_value(char c);
 bool uri_has_escape(const char *uri, int uri_len);
-const char *get_mime(const char *uri);
+int normalise_uri(char *uri, int uri_len);
 int get_path(const char *path_root, const char *uri, const int uri_len, char **path_dest);
+bool is_dir_uri(const char *uri, int uri_len);
+int append_index_file(char *uri, int uri_len);
 int get_body_fd(const char *path);
 
 // Process partial requests as they are updated on-the-fly, caching previous progress for improved performance.
@@ -114,8 +125,9 @@ enum request_stage_t process_partial_request(request_t *req, size_t buffer_len)
 }
 
 // Given a valid processes request object, extract and validate its URI for additional rules (path escape),
-// open the file, get its mime, and build the response.
-response_t *make_response(const char *path_root, const request_t *req) {
+// open the file, get its mime, and build the response. Directory URIs resolve to their index.html, or else to a
+// listing if is_autoindex.
+response_t *make_response(const char *path_root, bool is_autoindex, const request_t *req) {
     if (path_root == NULL || req == NULL) {
         return NULL;
     }
@@ -133,7 +145,7 @@ response_t *make_response(const char *path_root, const request_t *req) {
         return response_create_404();
     }
 
-    // get full path.
+    // get full path, which for a directory is that of its index file.
     char *body_path = NULL;
     int path_len = get_path(path_root, uri, uri_len, &body_path);
     if (path_len < 0) {
@@ -141,27 +153,129 @@ response_t *make_response(const char *path_root, const request_t *req) {
         return response_create_404();
     }
 
-    // attempt to open the file.
+    // attempt to open the file, falling back to a directory listing.
     int body_fd = get_body_fd(body_path);
-    free(body_path);
-    body_path = NULL;
     if (body_fd < 0) {
+        response_t *res_listing = NULL;
+        if (is_autoindex && is_dir_uri(uri, uri_len)) {
+            // A listing is HTML standing in for the index file, so it takes the .html cache policy.
+            const char *cache_control = header_cache_policy(body_path);
+            body_path[path_len - INDEX_FILE_LEN] = '\0';
+            autoindex_page_t *page = autoindex_get(body_path, uri);
+            if (page != NULL) {
+                res_listing = response_create_200_listing(page, cache_control);
+                hotset_record(uri, normalise_uri(uri, uri_len));
+            }
+        }
+        free(body_path);
+        body_path = NULL;
         free(uri);
         uri = NULL;
-        return response_create_404();
+        return res_listing != NULL ? res_listing : response_create_404();
     }
 
-    // get mime type.
-    const char *mime = get_mime(uri);
+    // get mime type and cache policy from the file actually served, and count the request towards the hot set under
+    // its canonical path, as bundles do, so that spellings of the same path are counted together.
+    const char *mime = get_mime(body_path);
+    const char *cache_control = header_cache_policy(body_path);
+    free(body_path);
+    body_path = NULL;
+    hotset_record(uri, normalise_uri(uri, uri_len));
     free(uri);
     uri = NULL;
 
     // craft response.
-    response_t *res_ok = response_create_200(body_fd, mime);
+    response_t *res_ok = response_create_200(body_fd, mime, cache_control);
 
     return res_ok;
 }
 
+// Given a valid processed request object, validate its URI as above and look it up in a bundle, building the response
+// without touching the filesystem. Directory URIs resolve to their index.html.
+response_t *make_bundle_response(const bundle_t *bundle, const request_t *req) {
+    if (bundle == NULL || req == NULL) {
+        return NULL;
+    }
+
+    // Copy the URI to the stack rather than the heap, since it is only needed for the lookup.
+    char uri[REQUEST_SIZE + INDEX_FILE_LEN + 1];
+    int uri_len = req->space_ptr - req->slash_ptr;
+    memcpy(uri, req->slash_ptr, uri_len);
+    uri[uri_len] = '\0';
+    uri_len = decode_uri(uri, uri_len);
+    if (uri_len == GET_URI_FAILED) {
+        return response_create_400();
+    }
+
+    // 404 URIs which traverse upwards the directory tree, then resolve the rest as the filesystem would.
+    if (uri_has_escape(uri, uri_len)) {
+        return response_create_404();
+    }
+    uri_len = normalise_uri(uri, uri_len);
+    int lookup_len = append_index_file(uri, uri_len);
+
+    const bundle_entry_t *entry = bundle_lookup(bundle, uri, lookup_len);
+    if (entry == NULL) {
+        return response_create_404();
+    }
+    const char *cache_control = header_cache_policy(uri);
+    // Count the path as requested rather than its index file, as for the filesystem.
+    uri[uri_len] = '\0';
+    hotset_record(uri, uri_len);
+    return response_create_200_bundled(bundle->fd, (const char *)bundle->base + entry->header_offset,
+                                       entry->header_len, entry->body_offset, entry->body_size, cache_control);
+}
+
+// Starts reading a URI's body into the page cache ahead of its first request. posix_fadvise() with
+// POSIX_FADV_WILLNEED is the portable form of Linux's readahead(), and likewise returns without waiting for the reads.
+// A directory served as a listing instead has its listing rendered into the autoindex cache.
+off_t prefetch_uri(const char *path_root, bool is_autoindex, const bundle_t *bundle, const char *uri) {
+    int uri_len = strlen(uri);
+    if (uri[0] != SLASH_CHAR || uri_len > REQUEST_SIZE || uri_has_escape(uri, uri_len)) {
+        return NOT_FOUND_REQUEST;
+    }
+
+    // Bundle lookups also fault in the index pages they probe, priming the index along with the body.
+    if (bundle != NULL) {
+        char norm_uri[REQUEST_SIZE + INDEX_FILE_LEN + 1];
+        memcpy(norm_uri, uri, uri_len + 1);
+        uri_len = normalise_uri(norm_uri, uri_len);
+        uri_len = append_index_file(norm_uri, uri_len);
+        const bundle_entry_t *entry = bundle_lookup(bundle, norm_uri, uri_len);
+        if (entry == NULL) {
+            return NOT_FOUND_REQUEST;
+        }
+        posix_fadvise(bundle->fd, entry->body_offset, entry->body_size, POSIX_FADV_WILLNEED);
+        return entry->body_size;
+    }
+
+    char *body_path = NULL;
+    int path_len = get_path(path_root, uri, uri_len, &body_path);
+    if (path_len < 0) {
+        return NOT_FOUND_REQUEST;
+    }
+    int body_fd = get_body_fd(body_path);
+    if (body_fd < 0) {
+        off_t listing_size = NOT_FOUND_REQUEST;
+        if (is_autoindex && is_dir_uri(uri, uri_len)) {
+            body_path[path_len - INDEX_FILE_LEN] = '\0';
+            autoindex_page_t *page = autoindex_get(body_path, uri);
+            if (page != NULL) {
+                listing_size = page->body_len;
+                autoindex_release(page);
+            }
+        }
+        free(body_path);
+        return listing_size;
+    }
+    free(body_path);
+    struct stat st;
+    fstat(body_fd, &st);
+    posix_fadvise(body_fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+    close(body_fd);
+    return st.st_size;
+}
+
 // Gets the Request-Line URI given a processed request.
 int get_request_uri(const request_t *req, char **uri_dest) {
     // Copy uri path to new array.
@@ -173,10 +287,55 @@ int get_request_uri(const request_t *req, char **uri_dest) {
     }
     strncpy(uri, req->slash_ptr, uri_len);
     uri[uri_len] = '\0';
+    uri_len = decode_uri(uri, uri_len);
+    if (uri_len == GET_URI_FAILED) {
+        free(uri);
+        return GET_URI_FAILED;
+    }
     *uri_dest = uri;
     return uri_len;
 }
 
+// Decodes "%XX" escapes in-place, so that paths which needed escaping in the request line, such as those the listings
+// link to, name their files. Runs before any path checks, so an escaped "/.." is rejected like any other. Returns the
+// new length, or GET_URI_FAILED for a malformed escape or a control character, which no served path contains: a NUL
+// would end the path early, and a line break would split a line of the hot-set manifest.
+int decode_uri(char *uri, int uri_len) {
+    int dst = 0;
+    for (int src = 0; src < uri_len; src++) {
+        char c = uri[src];
+        if (c == PERCENT_CHAR) {
+            int high = src + 2 < uri_len ? hex_value(uri[src + 1]) : -1;
+            int low = high >= 0 ? hex_value(uri[src + 2]) : -1;
+            if (low < 0) {
+                return GET_URI_FAILED;
+            }
+            c = (char)(high << 4 | low);
+            src += 2;
+        }
+        if ((unsigned char)c < ' ' || c == 0x7f) {
+            return GET_URI_FAILED;
+        }
+        uri[dst++] = c;
+    }
+    uri[dst] = '\0';
+    return dst;
+}
+
+// Gets the value of a hexadecimal digit, or -1 if c is not one.
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
 // Takes two non-empty strings and returns true if str's suffix equals `suffix`.
 bool strsuffix(const char *str, size_t str_len, const char *suffix, size_t suffix_len) {
     if (str == NULL || suffix == NULL || str_len <= 0 || suffix_len <= 0) {
@@ -202,6 +361,35 @@ bool uri_has_escape(const char *uri, int uri_len) {
     return has_middle_escape;
 }
 
+// Removes empty and "." path segments in-place, which the filesystem would otherwise skip over when resolving a path.
+// Bundles are keyed by the canonical path, so e.g. "/./subdir//other.html" becomes "/subdir/other.html". A final "."
+// segment is kept, since the filesystem only resolves it against a directory, never a file: "/index.html/." must stay
+// a 404 rather than name "/index.html". Returns the new length. Assumes "/.." segments have already been rejected.
+int normalise_uri(char *uri, int uri_len) {
+    bool has_trailing_slash = uri_len > 1 && uri[uri_len - 1] == SLASH_CHAR;
+    int src = 0, dst = 0;
+    while (src < uri_len) {
+        // Skip the slash, then measure the segment up to the next slash.
+        src++;
+        int seg_start = src;
+        while (src < uri_len && uri[src] != SLASH_CHAR) {
+            src++;
+        }
+        int seg_len = src - seg_start;
+        if (seg_len == 0 || (seg_len == 1 && uri[seg_start] == DOT_CHAR && src < uri_len)) {
+            continue;
+        }
+        uri[dst++] = SLASH_CHAR;
+        memmove(&uri[dst], &uri[seg_start], seg_len);
+        dst += seg_len;
+    }
+    if (dst == 0 || has_trailing_slash) {
+        uri[dst++] = SLASH_CHAR;
+    }
+    uri[dst] = '\0';
+    return dst;
+}
+
 // Gets the mime-type string literal for a valid URI.
 const char *get_mime(const char *uri) {
     // Guaranteed that uri contains at least one '/' since previous checks for abs_path have been done.
@@ -221,10 +409,26 @@ const char *get_mime(const char *uri) {
     return mime_default;
 }
 
-// Gets the full path to a resource.
+// True if a URI names a directory, i.e. ends with a slash. Directories named without one stay 404, as for any other
+// path which is not a file.
+bool is_dir_uri(const char *uri, int uri_len) {
+    return uri_len > 0 && uri[uri_len - 1] == SLASH_CHAR;
+}
+
+// Appends the index file's name to a directory URI, which has room for it. Returns the new length.
+int append_index_file(char *uri, int uri_len) {
+    if (!is_dir_uri(uri, uri_len)) {
+        return uri_len;
+    }
+    memcpy(uri + uri_len, INDEX_FILE, INDEX_FILE_LEN + 1);
+    return uri_len + INDEX_FILE_LEN;
+}
+
+// Gets the full path to a resource, or to the index file of a directory.
 int get_path(const char *path_root, const char *uri, const int uri_len, char **path_dest) {
     // Allocate full path
-    int path_len = strlen(path_root) + uri_len;
+    int index_len = is_dir_uri(uri, uri_len) ? INDEX_FILE_LEN : 0;
+    int path_len = strlen(path_root) + uri_len + index_len;
     char *full_path = malloc(sizeof(*full_path) * (path_len + 1));
     if (full_path == NULL) {
         // This reeeeally shouldn't happen, but drop the request if necessary
@@ -234,14 +438,18 @@ int get_path(const char *path_root, const char *uri, const int uri_len, char **p
     // Concat string. TODO: check if \0 is needed at the end.
     strcpy(full_path, path_root);
     strcat(full_path, uri);
+    if (index_len > 0) {
+        strcat(full_path, INDEX_FILE);
+    }
     *path_dest = full_path;
     return path_len;
 }
 
 // Open and return a handle to an existing file.
 int get_body_fd(const char *path) {
-    // Get file descriptor, if path points to a present filesystem location.
-    int body_fd = open(path, O_RDONLY);
+    // Get file descriptor, if path points to a present filesystem location. Close-on-exec keeps it from leaking into a
+    // restarted server process.
+    int body_fd = open(path, O_RDONLY | O_CLOEXEC);
     if (body_fd < 0) {
         return NOT_FOUND_REQUEST;
     }
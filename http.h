@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/types.h>
 
+#include "bundle.h"
 #include "response.h"
 
 #define REQUEST_SIZE 2400
@@ -25,7 +27,20 @@ typedef struct request_t {
 enum request_stage_t process_partial_request(request_t *req, size_t buffer_len);
 
 // Given a valid processes request object, extract and validate its URI for additional rules (path escape),
-// open the file, get its mime, and build the response.
-response_t *make_response(const char *path_root, const request_t *req);
+// open the file, get its mime, and build the response. Directory URIs resolve to their index.html, or else to a
+// listing if is_autoindex.
+response_t *make_response(const char *path_root, bool is_autoindex, const request_t *req);
+
+// Given a valid processed request object, validate its URI as above and look it up in a bundle, building the response
+// without touching the filesystem. Directory URIs resolve to their index.html.
+response_t *make_bundle_response(const bundle_t *bundle, const request_t *req);
+
+// Starts reading a URI's body into the page cache ahead of its first request, for the startup warm-up, or with
+// is_autoindex renders a directory's listing into the autoindex cache. URIs are validated and resolved as for requests.
+// Returns the number of bytes prefetched or rendered, or a negative value if the URI would be 404.
+off_t prefetch_uri(const char *path_root, bool is_autoindex, const bundle_t *bundle, const char *uri);
+
+// Gets the mime-type string literal for a valid URI.
+const char *get_mime(const char *uri);
 
 #endif // !HTTP_H
\ No newline at end of file
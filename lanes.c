@@ -0,0 +1,75 @@
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "lanes.h"
+
+#define NS_PER_USEC 1000L
+#define NS_PER_SEC 1000000000L
+
+// Size-aware scheduling of responses into a small lane and a bulk lane.
+
+static pthread_mutex_t lanes_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bulk_slot_freed = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t small_lane_idle = PTHREAD_COND_INITIALIZER;
+static unsigned long bulk_slots = 1;
+static unsigned long bulk_active = 0;
+static unsigned long small_active = 0;
+
+// Sets the number of bulk responses which may be sent at once.
+void lanes_init(unsigned long slots) {
+    bulk_slots = slots > 0 ? slots : 1;
+}
+
+// Classifies a response by its body size and enters its lane, waiting for a free slot if it is bulk.
+lane_t lane_enter(off_t body_size) {
+    pthread_mutex_lock(&lanes_lock);
+    lane_t lane;
+    if (body_size <= LANE_SMALL_MAX_BYTES) {
+        lane = LANE_SMALL;
+        small_active++;
+    } else {
+        lane = LANE_BULK;
+        while (bulk_active >= bulk_slots) {
+            pthread_cond_wait(&bulk_slot_freed, &lanes_lock);
+        }
+        bulk_active++;
+    }
+    pthread_mutex_unlock(&lanes_lock);
+    return lane;
+}
+
+// Leaves a lane once the response has been sent, waking bulk responses waiting on it.
+void lane_leave(lane_t lane) {
+    pthread_mutex_lock(&lanes_lock);
+    if (lane == LANE_SMALL) {
+        if (--small_active == 0) {
+            pthread_cond_broadcast(&small_lane_idle);
+        }
+    } else {
+        bulk_active--;
+        pthread_cond_signal(&bulk_slot_freed);
+    }
+    pthread_mutex_unlock(&lanes_lock);
+}
+
+// Called by bulk responses between chunks: waits, up to LANE_BULK_YIELD_USECS, while small responses are in flight.
+void lane_yield_bulk() {
+    pthread_mutex_lock(&lanes_lock);
+    if (small_active > 0) {
+        // pthread_cond_timedwait() takes an absolute deadline on the realtime clock.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LANE_BULK_YIELD_USECS * NS_PER_USEC;
+        if (deadline.tv_nsec >= NS_PER_SEC) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= NS_PER_SEC;
+        }
+        while (small_active > 0) {
+            if (pthread_cond_timedwait(&small_lane_idle, &lanes_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lanes_lock);
+}
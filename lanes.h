@@ -0,0 +1,32 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <sys/types.h>
+
+// Size-aware scheduling of responses into a small lane and a bulk lane. Since the body size of a response is known
+// before any byte is sent, each response is classified up front. Small responses always start immediately, while bulk
+// responses share a bounded number of slots and are sent in chunks, yielding between chunks whenever small responses
+// are in flight. A burst of large downloads therefore cannot starve the small HTML/CSS/JS requests behind it.
+
+// Bodies up to this size are sent in the small lane.
+#define LANE_SMALL_MAX_BYTES (256 * 1024)
+// Bulk bodies are sent in chunks of this size, with a chance to yield to the small lane between chunks.
+#define LANE_BULK_CHUNK_BYTES (1024 * 1024)
+// The longest a bulk response waits for in-flight small responses between chunks, so bulk traffic is never starved.
+#define LANE_BULK_YIELD_USECS 2000
+
+typedef enum lane_t { LANE_SMALL, LANE_BULK } lane_t;
+
+// Sets the number of bulk responses which may be sent at once. Called before any client threads exist.
+void lanes_init(unsigned long bulk_slots);
+
+// Classifies a response by its body size and enters its lane, waiting for a free slot if it is bulk.
+lane_t lane_enter(off_t body_size);
+
+// Leaves a lane once the response has been sent.
+void lane_leave(lane_t lane);
+
+// Called by bulk responses between chunks: waits, up to LANE_BULK_YIELD_USECS, while small responses are in flight.
+void lane_yield_bulk();
+
+#endif // !LANES_H
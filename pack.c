@@ -0,0 +1,319 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bundle.h"
+#include "header.h"
+#include "http.h"
+
+#define ETAG_BUF_SIZE 48
+#define TMP_SUFFIX ".tmp"
+#define SLASH_STR "/"
+
+// Offline packer which compiles a web root into a single bundle file for the server to serve from. Every regular file
+// the server could serve becomes an entry keyed by its request path, e.g. "/assets/image.jpg", with the representation
+// part of its 200 header precomputed. The bundle is written to a temporary file and renamed into place, so a running
+// deployment only ever sees a complete bundle.
+
+// A file found in the web root, to be packed.
+typedef struct pack_file_t {
+    char *uri;
+    char *fs_path;
+    off_t size;
+    time_t mtime;
+} pack_file_t;
+
+typedef struct pack_list_t {
+    pack_file_t *files;
+    size_t len;
+    size_t cap;
+} pack_list_t;
+
+// Function prototypes.
+void collect_files(const char *fs_dir, const char *uri_dir, pack_list_t *list);
+void pack_list_push(pack_list_t *list, const char *uri, const char *fs_path, const struct stat *st);
+int compare_files(const void *a, const void *b);
+void write_bundle(const pack_list_t *list, const char *bundle_path);
+void write_all(int fd, const void *buf, size_t len);
+void copy_body(int out_fd, const pack_file_t *file, uint64_t offset);
+uint64_t align_up(uint64_t offset, uint64_t align);
+char *path_join(const char *dir, const char *name);
+void *malloc_strict(size_t size);
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: ./pack [path to web root] [bundle path]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pack_list_t list = {.files = NULL, .len = 0, .cap = 0};
+    collect_files(argv[1], "", &list);
+
+    // Sorting makes bundles reproducible, regardless of directory iteration order.
+    qsort(list.files, list.len, sizeof(*list.files), compare_files);
+    write_bundle(&list, argv[2]);
+    printf("pack: wrote %zu files to %s\n", list.len, argv[2]);
+
+    for (size_t i = 0; i < list.len; i++) {
+        free(list.files[i].uri);
+        free(list.files[i].fs_path);
+    }
+    free(list.files);
+    return 0;
+}
+
+// Recursively collects every regular file under fs_dir which the server would be able to open.
+void collect_files(const char *fs_dir, const char *uri_dir, pack_list_t *list) {
+    DIR *dir = opendir(fs_dir);
+    if (dir == NULL) {
+        fprintf(stderr, "pack: skipping unreadable directory %s: %s\n", fs_dir, strerror(errno));
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        char *fs_path = path_join(fs_dir, ent->d_name);
+        char *uri = path_join(uri_dir, ent->d_name);
+
+        // stat() rather than lstat(), following symlinks as open() does when serving from the filesystem.
+        struct stat st;
+        if (stat(fs_path, &st) < 0) {
+            fprintf(stderr, "pack: skipping %s: %s\n", fs_path, strerror(errno));
+        } else if (S_ISDIR(st.st_mode)) {
+            collect_files(fs_path, uri, list);
+        } else if (S_ISREG(st.st_mode)) {
+            if (access(fs_path, R_OK) == 0) {
+                pack_list_push(list, uri, fs_path, &st);
+            } else {
+                // Unreadable files are 404 when served from the filesystem, so they are left out of the bundle too.
+                fprintf(stderr, "pack: skipping unreadable file %s\n", fs_path);
+            }
+        }
+        free(fs_path);
+        free(uri);
+    }
+    closedir(dir);
+}
+
+void pack_list_push(pack_list_t *list, const char *uri, const char *fs_path, const struct stat *st) {
+    if (list->len == list->cap) {
+        list->cap = list->cap == 0 ? 64 : list->cap * 2;
+        list->files = realloc(list->files, sizeof(*list->files) * list->cap);
+        if (list->files == NULL) {
+            perror("realloc: pack_list_push");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pack_file_t *file = &list->files[list->len++];
+    file->uri = strdup(uri);
+    file->fs_path = strdup(fs_path);
+    if (file->uri == NULL || file->fs_path == NULL) {
+        perror("strdup: pack_list_push");
+        exit(EXIT_FAILURE);
+    }
+    file->size = st->st_size;
+    file->mtime = st->st_mtime;
+}
+
+int compare_files(const void *a, const void *b) {
+    return strcmp(((const pack_file_t *)a)->uri, ((const pack_file_t *)b)->uri);
+}
+
+// Lays out and writes the bundle: the index and strings in one write, then each body copied in at its aligned offset.
+void write_bundle(const pack_list_t *list, const char *bundle_path) {
+    if (list->len >= UINT32_MAX / 2) {
+        fprintf(stderr, "pack: too many files.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Size the hash table to a power of two at most half full, keeping probe sequences short.
+    uint32_t n_slots = 2;
+    while (n_slots < list->len * 2) {
+        n_slots *= 2;
+    }
+
+    // Precompute the representation part of each file's 200 header, up front so the size of the strings section is
+    // known. The server appends the per-response fields.
+    char **headers = malloc_strict(sizeof(*headers) * (list->len + 1));
+    size_t *header_lens = malloc_strict(sizeof(*header_lens) * (list->len + 1));
+    uint64_t strings_size = 0;
+    for (size_t i = 0; i < list->len; i++) {
+        const pack_file_t *file = &list->files[i];
+        char etag[ETAG_BUF_SIZE];
+        snprintf(etag, sizeof(etag), "%llx-%llx", (unsigned long long)file->mtime, (unsigned long long)file->size);
+        // The MIME type and ETag are both short, so the header always fits the buffer.
+        char header[HEADER_BUFFER_SIZE];
+        size_t len = header_begin_200(header, file->size, get_mime(file->uri), file->mtime, etag);
+        if (len > HEADER_REPRESENTATION_MAX) {
+            fprintf(stderr, "pack: could not format header for %s\n", file->uri);
+            exit(EXIT_FAILURE);
+        }
+        headers[i] = malloc_strict(len);
+        memcpy(headers[i], header, len);
+        header_lens[i] = len;
+        strings_size += strlen(file->uri) + len;
+    }
+
+    // Index layout, with each section naturally aligned.
+    uint64_t slots_offset = align_up(sizeof(bundle_header_t), sizeof(uint32_t));
+    uint64_t entries_offset = align_up(slots_offset + (uint64_t)n_slots * sizeof(uint32_t), sizeof(uint64_t));
+    uint64_t strings_offset = entries_offset + list->len * sizeof(bundle_entry_t);
+    uint64_t index_size = strings_offset + strings_size;
+
+    unsigned char *index = calloc(1, index_size);
+    if (index == NULL) {
+        perror("calloc: write_bundle");
+        exit(EXIT_FAILURE);
+    }
+    bundle_header_t *header = (bundle_header_t *)index;
+    memcpy(header->magic, BUNDLE_MAGIC, BUNDLE_MAGIC_LEN);
+    header->version = BUNDLE_VERSION;
+    header->n_entries = list->len;
+    header->n_slots = n_slots;
+    header->slots_offset = slots_offset;
+    header->entries_offset = entries_offset;
+
+    uint32_t *slots = (uint32_t *)(index + slots_offset);
+    for (uint32_t i = 0; i < n_slots; i++) {
+        slots[i] = BUNDLE_EMPTY_SLOT;
+    }
+
+    // Fill in entries, strings and hash slots, assigning each body a page-aligned offset after the index.
+    bundle_entry_t *entries = (bundle_entry_t *)(index + entries_offset);
+    uint64_t string_pos = strings_offset;
+    uint64_t body_pos = align_up(index_size, BUNDLE_ALIGN);
+    for (size_t i = 0; i < list->len; i++) {
+        const pack_file_t *file = &list->files[i];
+        bundle_entry_t *entry = &entries[i];
+        size_t uri_len = strlen(file->uri);
+
+        entry->hash = bundle_hash(file->uri, uri_len);
+        entry->path_offset = string_pos;
+        entry->path_len = uri_len;
+        memcpy(index + string_pos, file->uri, uri_len);
+        string_pos += uri_len;
+
+        entry->header_offset = string_pos;
+        entry->header_len = header_lens[i];
+        memcpy(index + string_pos, headers[i], header_lens[i]);
+        string_pos += header_lens[i];
+
+        entry->body_offset = body_pos;
+        entry->body_size = file->size;
+        body_pos = align_up(body_pos + file->size, BUNDLE_ALIGN);
+
+        // Linear probing, as in bundle_lookup().
+        uint32_t mask = n_slots - 1;
+        uint32_t slot = entry->hash & mask;
+        while (slots[slot] != BUNDLE_EMPTY_SLOT) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i;
+    }
+
+    // Write to a temporary file, then atomically rename it over any previous bundle.
+    char *tmp_path = malloc_strict(strlen(bundle_path) + sizeof(TMP_SUFFIX));
+    strcpy(tmp_path, bundle_path);
+    strcat(tmp_path, TMP_SUFFIX);
+    int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        perror("open: bundle");
+        exit(EXIT_FAILURE);
+    }
+    write_all(out_fd, index, index_size);
+    for (size_t i = 0; i < list->len; i++) {
+        copy_body(out_fd, &list->files[i], entries[i].body_offset);
+    }
+
+    // Bodies were written at aligned offsets, so extend over any trailing padding for the last one.
+    if (ftruncate(out_fd, body_pos) < 0 || fsync(out_fd) < 0 || close(out_fd) < 0) {
+        perror("write: bundle");
+        exit(EXIT_FAILURE);
+    }
+    if (rename(tmp_path, bundle_path) < 0) {
+        perror("rename: bundle");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < list->len; i++) {
+        free(headers[i]);
+    }
+    free(headers);
+    free(header_lens);
+    free(index);
+    free(tmp_path);
+}
+
+void write_all(int fd, const void *buf, size_t len) {
+    const unsigned char *pos = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, pos, len);
+        if (n < 0) {
+            perror("write: bundle");
+            exit(EXIT_FAILURE);
+        }
+        pos += n;
+        len -= n;
+    }
+}
+
+// Copies a file's body into the bundle at its offset with sendfile(), which keeps the copy within the kernel.
+void copy_body(int out_fd, const pack_file_t *file, uint64_t offset) {
+    int in_fd = open(file->fs_path, O_RDONLY);
+    if (in_fd < 0) {
+        perror("open: body");
+        exit(EXIT_FAILURE);
+    }
+    if (lseek(out_fd, offset, SEEK_SET) < 0) {
+        perror("lseek: bundle");
+        exit(EXIT_FAILURE);
+    }
+
+    off_t bytes_left = file->size;
+    while (bytes_left > 0) {
+        size_t count = bytes_left > SSIZE_MAX ? SSIZE_MAX : bytes_left;
+        ssize_t n = sendfile(out_fd, in_fd, NULL, count);
+        if (n <= 0) {
+            // Also catches a file which shrank since it was collected, which would otherwise corrupt the bundle.
+            fprintf(stderr, "pack: could not copy %s\n", file->fs_path);
+            exit(EXIT_FAILURE);
+        }
+        bytes_left -= n;
+    }
+    close(in_fd);
+}
+
+uint64_t align_up(uint64_t offset, uint64_t align) {
+    return (offset + align - 1) / align * align;
+}
+
+// Joins a directory and a name with a slash into a newly allocated string.
+char *path_join(const char *dir, const char *name) {
+    char *path = malloc_strict(strlen(dir) + strlen(SLASH_STR) + strlen(name) + 1);
+    strcpy(path, dir);
+    strcat(path, SLASH_STR);
+    strcat(path, name);
+    return path;
+}
+
+// The packer is a short-lived tool, so exiting on allocation failure is simpler than unwinding.
+void *malloc_strict(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
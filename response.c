@@ -6,22 +6,13 @@
 
 #include "response.h"
 
-#define HTTP_VERSION "HTTP/1.0"
-#define CRLF "\r\n"
-#define HTTP_CLENGTH_PREFIX "Content-Length:"
-#define HTTP_CTYPE_PREFIX "Content-Type:"
-#define SP " "
+#define HTTP_404_STATUS "404 Not Found"
+#define HTTP_400_STATUS "400 Bad Request"
 
 // Response objects which encapsulate all the data necessary for the server to form a request to be directly written
 // back to a client. This ensures separation of concerns by letting one module handle all system calls, and another
 // module handle request string processing.
 
-// Header string templates.
-char HTTP_404_HEADER[] = HTTP_VERSION SP "404 Not Found" CRLF HTTP_CLENGTH_PREFIX SP "0" CRLF CRLF;
-char HTTP_400_HEADER[] = HTTP_VERSION SP "400 Bad Request" CRLF HTTP_CLENGTH_PREFIX SP "0" CRLF CRLF;
-const char HTTP_200_HEADER[] =
-    HTTP_VERSION SP "200 OK" CRLF HTTP_CLENGTH_PREFIX SP "%zu" CRLF HTTP_CTYPE_PREFIX SP "%s" CRLF CRLF;
-
 // Initialise a defaulted builder response.
 static response_t *response_create() {
     // Heap allocation
@@ -30,11 +21,14 @@ static response_t *response_create() {
         return NULL;
     }
 
-    res->header = NULL;
+    res->header = res->header_buffer;
     res->header_size = 0;
     res->body_fd = -1;
     res->body_buffer = NULL;
+    res->body_offset = 0;
     res->body_size = 0;
+    res->is_bundled = false;
+    res->listing = NULL;
 
     return res;
 }
@@ -48,8 +42,8 @@ response_t *response_create_404() {
 
     // Save header only.
     res->status = HTTP_404;
-    res->header = HTTP_404_HEADER;
-    res->header_size = strlen(res->header);
+    res->header_size = header_begin_empty(res->header, HTTP_404_STATUS);
+    res->header_size = header_finish(res->header, res->header_size, NULL);
     return res;
 }
 
@@ -62,13 +56,13 @@ response_t *response_create_400() {
 
     // Save header only.
     res->status = HTTP_400;
-    res->header = HTTP_400_HEADER;
-    res->header_size = strlen(res->header);
+    res->header_size = header_begin_empty(res->header, HTTP_400_STATUS);
+    res->header_size = header_finish(res->header, res->header_size, NULL);
     return res;
 }
 
 // Create a 200 response. Creates header and stores file descriptor and mime-type.
-response_t *response_create_200(int fd, const char *mime) {
+response_t *response_create_200(int fd, const char *mime, const char *cache_control) {
     response_t *res = response_create();
     if (res == NULL) {
         close(fd);
@@ -84,32 +78,52 @@ response_t *response_create_200(int fd, const char *mime) {
     fstat(fd, &st);
     res->body_size = st.st_size;
 
-    // Format header in buffer of sufficient size.
-    int size_needed = snprintf(NULL, 0, HTTP_200_HEADER, st.st_size, mime);
-    if (size_needed < 0) {
-        perror("snprintf: response_create_200");
-        free(res);
+    // Build header in the response's own buffer.
+    res->header_size = header_begin_200(res->header, st.st_size, mime, st.st_mtime, NULL);
+    res->header_size = header_finish(res->header, res->header_size, cache_control);
+
+    return res;
+}
+
+// Create a 200 response served from a bundle, whose header's representation part was precomputed by ./pack and whose
+// body lies at an offset within the bundle's file descriptor. header_size is at most HEADER_REPRESENTATION_MAX.
+response_t *response_create_200_bundled(int fd, const char *header, size_t header_size, off_t offset, off_t size,
+                                        const char *cache_control) {
+    response_t *res = response_create();
+    if (res == NULL) {
         return NULL;
     }
 
-    char *header = malloc(sizeof(*header) * (size_needed + 1));
-    if (header == NULL) {
-        // Malloc failure
-        perror("malloc: response_create_200");
-        free(res);
+    // The bundle outlives every response, so its fd is borrowed rather than duplicated.
+    res->status = HTTP_200;
+    memcpy(res->header, header, header_size);
+    res->header_size = header_finish(res->header, header_size, cache_control);
+    res->body_fd = fd;
+    res->body_offset = offset;
+    res->body_size = size;
+    res->is_bundled = true;
+    return res;
+}
+
+// Create a 200 response whose body is a directory listing, with the representation part of its header rendered along
+// with it.
+response_t *response_create_200_listing(autoindex_page_t *listing, const char *cache_control) {
+    response_t *res = response_create();
+    if (res == NULL) {
+        autoindex_release(listing);
         return NULL;
     }
-    snprintf(header, size_needed + 1, HTTP_200_HEADER, st.st_size, mime);
-
-    // Update header in response
-    res->header = header;
-    res->header_size = size_needed;
 
+    res->status = HTTP_200;
+    memcpy(res->header, listing->header, listing->header_len);
+    res->header_size = header_finish(res->header, listing->header_len, cache_control);
+    res->body_buffer = listing->body;
+    res->body_size = listing->body_len;
+    res->listing = listing;
     return res;
 }
 
-// Frees a response object, including freeing heap-allocated headers and closing files, based on the status code of the
-// response.
+// Frees a response object, including closing files, based on the status code of the response.
 void response_free(response_t *res) {
     if (res == NULL) {
         return;
@@ -117,8 +131,11 @@ void response_free(response_t *res) {
 
     switch (res->status) {
     case HTTP_200:
-        free(res->header);
-        close(res->body_fd);
+        if (res->listing != NULL) {
+            autoindex_release(res->listing);
+        } else if (!res->is_bundled) {
+            close(res->body_fd);
+        }
         break;
     default:
         break;
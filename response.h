@@ -1,27 +1,47 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <stdbool.h>
 #include <sys/types.h>
 
+#include "autoindex.h"
+#include "header.h"
+
 // Response objects which encapsulate all the data necessary for the server to form a request to be directly written
 // back to a client. This ensures separation of concerns by letting one module handle all system calls, and another
 // module handle request string processing.
 
 typedef struct response_t {
     enum response_status_t { HTTP_400, HTTP_404, HTTP_200 } status;
+    // Points into header_buffer, where the header is built for each response.
     char *header;
+    char header_buffer[HEADER_BUFFER_SIZE];
     char *body_buffer;
     int body_fd;
     size_t header_size;
+    off_t body_offset;
     off_t body_size;
+    // The body_fd belongs to a bundle rather than to this response, so is not closed with it.
+    bool is_bundled;
+    // Set when body_buffer is a directory listing, which is shared and so released rather than freed.
+    autoindex_page_t *listing;
 } response_t;
 
 response_t *response_create_404();
 
-response_t *response_create_200(int fd, const char *mime);
+// Creates a 200 response for an open file. cache_control may be NULL.
+response_t *response_create_200(int fd, const char *mime, const char *cache_control);
 
 response_t *response_create_400();
 
+// Creates a 200 response for a body in a bundle, from the header precomputed by ./pack. cache_control may be NULL.
+response_t *response_create_200_bundled(int fd, const char *header, size_t header_size, off_t offset, off_t size,
+                                        const char *cache_control);
+
+// Creates a 200 response whose body is a directory listing, taking over the caller's reference to it. cache_control
+// may be NULL.
+response_t *response_create_200_listing(autoindex_page_t *listing, const char *cache_control);
+
 void response_free(response_t *res);
 
 #endif
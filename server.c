@@ -4,33 +4,107 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "bundle.h"
+#include "handoff.h"
+#include "header.h"
 #include "server_looper.h"
+#include "zerocopy.h"
 
 // Features:
 #define IMPLEMENTS_IPV6
 #define MULTITHREADED
 
+// Macro constants.
+#define DEFAULT_DRAIN_SECS 30
+#define DEFAULT_WARMUP_BUDGET_MS 2000
+#define DEFAULT_BULK_SLOTS 32
+#define PORT_NONE "-"
+#define USAGE                                                                                                          \
+    "usage: ./server [-d drain seconds] [-w hot-set manifest [-R] [-W warm-up budget ms]] [-u unix socket path] "     \
+    "[-B bulk slots] [-z zerocopy threshold bytes] [-c .ext=cache policy]... [-a] [4 | 6 | 46] [port number | -] "  \
+    "[path to web root or bundle]\n"
+
 // Function prototypes.
+unsigned long strtoul_strict(const char *str);
 uint8_t get_protocol(const char *str);
 char *get_root_path(char *path);
+const bundle_t *get_root_bundle(const char *path);
 void debug_server_input(uint8_t protocol, char *port, char *path);
 
 // Entry point of the server. Validates arguments, then hands off to the looper for continuous request handling.
 int main(int argc, char *argv[]) {
-    // Read arguments. Can assume well-formed provided arguments.
-    if (argc != 4) {
-        fprintf(stderr, "usage: ./server [4 | 6] [port number] [path to web root]\n");
+    // Read options, then the positional arguments. Can assume well-formed provided arguments.
+    server_config_t config = {.drain_secs = DEFAULT_DRAIN_SECS,
+                              .unix_path = NULL,
+                              .is_autoindex = false,
+                              .bulk_slots = DEFAULT_BULK_SLOTS,
+                              .zerocopy_threshold = ZEROCOPY_DEFAULT_THRESHOLD,
+                              .manifest_path = NULL,
+                              .is_recording_hotset = false,
+                              .warmup_budget_ms = DEFAULT_WARMUP_BUDGET_MS,
+                              .exe_path = handoff_exe_path(),
+                              .argv = argv};
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:RW:u:B:z:c:a")) != -1) {
+        switch (opt) {
+        case 'd':
+            config.drain_secs = strtoul_strict(optarg);
+            break;
+        case 'w':
+            config.manifest_path = optarg;
+            break;
+        case 'R':
+            config.is_recording_hotset = true;
+            break;
+        case 'W':
+            config.warmup_budget_ms = strtoul_strict(optarg);
+            break;
+        case 'u':
+            config.unix_path = optarg;
+            break;
+        case 'B':
+            config.bulk_slots = strtoul_strict(optarg);
+            break;
+        case 'z':
+            config.zerocopy_threshold = strtoul_strict(optarg);
+            break;
+        case 'a':
+            config.is_autoindex = true;
+            break;
+        case 'c':
+            if (!header_add_cache_policy(optarg)) {
+                fprintf(stderr, "server: invalid cache policy %s, expected e.g. .css=max-age=86400.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 3 || (config.is_recording_hotset && config.manifest_path == NULL)) {
+        fprintf(stderr, USAGE);
         exit(EXIT_FAILURE);
     }
-    uint8_t s_protocol = get_protocol(argv[1]);
-    char *s_port = argv[2];
-    char *s_root_path = get_root_path(argv[3]);
+    config.protocol = get_protocol(argv[optind]);
+    // A port of "-" listens only on the unix socket.
+    config.port = strcmp(argv[optind + 1], PORT_NONE) == 0 ? NULL : argv[optind + 1];
+    if (config.port == NULL && config.unix_path == NULL) {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+    config.bundle = get_root_bundle(argv[optind + 2]);
+    config.root_path = config.bundle != NULL ? argv[optind + 2] : get_root_path(argv[optind + 2]);
 
     // Run the server.
-    server_loop(s_protocol, s_port, s_root_path);
+    server_loop(&config);
 
-    // Any detached threads will also be terminated when main returns:
+    // In-flight clients have been drained by now, up to the drain deadline. Any detached threads still running will
+    // also be terminated when main returns:
     // https://man7.org/linux/man-pages/man3/pthread_detach.3.html (not code, just manpage)
     return 0;
 }
@@ -63,8 +137,8 @@ uint8_t get_protocol(const char *str) {
     // Converts string to ip protocol. Strict: exits if not a supported IP protocol.
     // uint8_t: a more compact representation, although an enum is also a decent solution.
     unsigned long val = strtoul_strict(str);
-    if (val != 4 && val != 6) {
-        fprintf(stderr, "server: not a supported protocol [4 | 6].\n");
+    if (val != 4 && val != 6 && val != PROTOCOL_DUAL_STACK) {
+        fprintf(stderr, "server: not a supported protocol [4 | 6 | 46].\n");
         exit(EXIT_FAILURE);
     }
     return (uint8_t)val;
@@ -83,6 +157,22 @@ char *get_root_path(char *path) {
     return path;
 }
 
+const bundle_t *get_root_bundle(const char *path) {
+    // A regular file given as the web root must be a bundle built by ./pack. Returns NULL for anything else, which is
+    // then checked as a directory. Exits if the file is not a valid bundle. The bundle stays mapped until the process
+    // exits, since draining clients may still be sending from it.
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    const bundle_t *bundle = bundle_open(path);
+    if (bundle == NULL) {
+        fprintf(stderr, "server: root path is neither a directory nor a bundle. exiting early.\n");
+        exit(EXIT_FAILURE);
+    }
+    return bundle;
+}
+
 void debug_server_input(uint8_t protocol, char *port, char *path) {
     printf("%d, %s, %s, eol\n", protocol, port, path);
     return;
@@ -1,7 +1,11 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -11,110 +15,277 @@
 #include <string.h>
 #include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "handoff.h"
+#include "hotset.h"
 #include "http.h"
+#include "lanes.h"
 #include "response.h"
 #include "server_looper.h"
+#include "zerocopy.h"
 
 // Macro constants.
 #define LISTEN_QUEUE_SIZE 20
 #define RECV_TIMEOUT_SECS 10
+#define SEND_TIMEOUT_SECS 10
+#define MS_PER_SEC 1000
+#define MAX_LISTENERS HANDOFF_MAX_FDS
+#define SIGNAL_POLL_IDX 0
+#define HANDOFF_POLL_IDX 1
+#define LISTENER_POLL_IDX 2
 
 // Signal status.
 volatile sig_atomic_t is_listening = true;
+volatile sig_atomic_t is_restarting = false;
+volatile sig_atomic_t is_terminating = false;
+
+// Self-pipe written to by the signal handler, so that a signal arriving just before the main loop blocks in poll() is
+// never missed.
+int signal_pipe[2] = {-1, -1};
+
+// Number of in-flight clients, so that shutdowns and restarts can drain responses instead of cutting them off.
+pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t clients_drained = PTHREAD_COND_INITIALIZER;
+unsigned long active_clients = 0;
+
+// The unix socket's path as this process bound or inherited it, so that only this process's own socket is removed on
+// shutdown, never one bound since at the same path by another server.
+bool has_unix_path_id = false;
+dev_t unix_path_dev;
+ino_t unix_path_ino;
 
 // Thread arguments.
 typedef struct client_args_t {
     int fd;
-    const char *root_path;
+    const server_config_t *config;
 } client_args_t;
 
 // Function prototypes.
 int socket_new(const uint8_t protocol, const char *port);
+int socket_unix_new(const char *path);
+bool is_unix_socket_stale(const struct sockaddr_un *addr);
+void unix_path_remember(const char *path);
+void unix_path_unlink(const char *path);
 static void termination_handler(int signum);
-client_args_t *client_args_create(int fd, const char *root_path);
+client_args_t *client_args_create(int fd, const server_config_t *config);
+void accept_client(int sockfd, const server_config_t *config, const pthread_attr_t *thread_attr,
+                   const struct timeval *timeout);
 void *client_thread(void *arg);
-int send_header(response_t *res, int client_sockfd);
-off_t send_fd_file(response_t *res, int client_sockfd);
+void serve_client(int client_sockfd, const server_config_t *config);
+int send_header(response_t *res, int client_sockfd, size_t zerocopy_threshold, zerocopy_t *zc);
+size_t send_buffer(int client_sockfd, const char *buf, size_t len, size_t zerocopy_threshold, zerocopy_t *zc);
+off_t send_fd_file(response_t *res, int client_sockfd, lane_t lane);
 void setup_signal_handling();
+int handoff_begin(const server_config_t *config, const int *listeners, size_t n_listeners, pid_t *pid_dest);
+bool handoff_finish(int handoff_fd, pid_t child_pid);
+void drain_clients(unsigned long drain_secs);
 
 // The main loop of the HTTP server.
 // All network-related system calls are orchestrated by functions in this file - this achieves good separation of
 // concerns. We handoff request data processing work to functions in other modules as necessary. sendfile() benefits
 // are described at the call site.
-int server_loop(uint8_t s_protocol, const char *s_port, const char *s_root_path) {
-    // Initialise listening socket.
-    int sockfd = socket_new(s_protocol, s_port);
+int server_loop(const server_config_t *config) {
+    int inherited_fd = handoff_inherited_fd();
+
+    // Warm the page cache for the hot set before listening, so that clients are not left queued in the backlog
+    // meanwhile. During a restart, the previous server process keeps accepting instead, and is told to stop only once
+    // this process is warm and ready.
+    if (config->is_recording_hotset) {
+        hotset_start_recording();
+    }
+    if (config->manifest_path != NULL) {
+        hotset_warm(config->manifest_path, config->warmup_budget_ms, config->root_path, config->is_autoindex,
+                    config->bundle);
+    }
 
-    // Register termination upon SIGINT and SIGTERM, and ignore SIGPIPE from clients.
+    // Initialise listening sockets, either inherited from the server process being restarted, or freshly bound.
+    int listeners[MAX_LISTENERS];
+    int n_listeners;
+    if (inherited_fd >= 0) {
+        n_listeners = handoff_recv_fds(inherited_fd, listeners, MAX_LISTENERS);
+        if (n_listeners <= 0) {
+            exit(EXIT_FAILURE);
+        }
+        // The unix socket's path was left in place by the previous server process and now belongs to this one.
+        if (config->unix_path != NULL) {
+            unix_path_remember(config->unix_path);
+        }
+    } else {
+        n_listeners = 0;
+        if (config->port != NULL) {
+            listeners[n_listeners++] = socket_new(config->protocol, config->port);
+        }
+        if (config->unix_path != NULL) {
+            listeners[n_listeners++] = socket_unix_new(config->unix_path);
+        }
+    }
+
+    // Register graceful termination upon SIGINT and SIGTERM, restarts upon SIGHUP, and ignore SIGPIPE from clients.
     setup_signal_handling();
 
     // Initialise timeout instance to be used for receiving requests from each client.
     const struct timeval timeout = {.tv_sec = RECV_TIMEOUT_SECS, .tv_usec = 0};
 
+    // Bound the number of bulk responses sent at once, leaving the small lane unbounded.
+    lanes_init(config->bulk_slots);
+
     // Define pthread attribute template to spawn pthreads detached by default.
     pthread_attr_t thread_attr;
     pthread_attr_init(&thread_attr);
     pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
 
+    // Wait on signals, the restart handoff, and all listening sockets at once.
+    struct pollfd pollfds[LISTENER_POLL_IDX + MAX_LISTENERS];
+    pollfds[SIGNAL_POLL_IDX] = (struct pollfd){.fd = signal_pipe[0], .events = POLLIN};
+    pollfds[HANDOFF_POLL_IDX] = (struct pollfd){.fd = -1, .events = POLLIN};
+    for (int i = 0; i < n_listeners; i++) {
+        pollfds[LISTENER_POLL_IDX + i] = (struct pollfd){.fd = listeners[i], .events = POLLIN};
+    }
+    pid_t child_pid = -1;
+    bool is_handed_off = false;
+
+    // Tell the previous server process, if any, that this one is warm and can take over accepting.
+    if (inherited_fd >= 0) {
+        handoff_send_ready(inherited_fd);
+    }
+
     // Accept connections from clients
-    int client_sockfd;
-    struct sockaddr_storage client_addr;
-    socklen_t client_addr_size = sizeof(client_addr);
     while (is_listening) {
-        client_sockfd = accept(sockfd, (struct sockaddr *)&client_addr, &client_addr_size);
-        if (client_sockfd < 0) {
-            // Could not accept: continue accepting other connections.
-            if (is_listening) {
-                perror("accept");
+        if (is_restarting && pollfds[HANDOFF_POLL_IDX].fd < 0) {
+            pollfds[HANDOFF_POLL_IDX].fd = handoff_begin(config, listeners, n_listeners, &child_pid);
+        }
+        is_restarting = false;
+
+        if (poll(pollfds, LISTENER_POLL_IDX + n_listeners, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
             }
             continue;
         }
 
-        // Set a receive timeout on the client socket before handing off to thread. Should never error out.
-        if (setsockopt(client_sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-            perror("setsockopt: client");
-            close(client_sockfd);
-            continue;
+        // Signal flags were already set by the handler: just empty the self-pipe.
+        if (pollfds[SIGNAL_POLL_IDX].revents & POLLIN) {
+            char discard[16];
+            while (read(signal_pipe[0], discard, sizeof(discard)) > 0) {
+            }
         }
 
-        // Prepare thread-local arguments for serving clients.
-        client_args_t *client_args = client_args_create(client_sockfd, s_root_path);
-        if (!is_listening || client_args == NULL) {
-            close(client_sockfd);
-            free(client_args);
-            continue;
+        // The new server process has either taken over accepting or failed to start.
+        if (pollfds[HANDOFF_POLL_IDX].revents) {
+            if (handoff_finish(pollfds[HANDOFF_POLL_IDX].fd, child_pid)) {
+                is_listening = false;
+                is_handed_off = true;
+            }
+            pollfds[HANDOFF_POLL_IDX].fd = -1;
         }
 
-        // Spawn a detached thread to receive and process a client request.
-        pthread_t thread;
-        if (pthread_create(&thread, &thread_attr, client_thread, (void *)client_args) < 0) {
-            perror("pthread_create");
-            close(client_sockfd);
-            free(client_args);
+        for (int i = 0; is_listening && i < n_listeners; i++) {
+            if (pollfds[LISTENER_POLL_IDX + i].revents & POLLIN) {
+                accept_client(listeners[i], config, &thread_attr, &timeout);
+            }
         }
     }
 
-    // No longer listening, clean-up the server.
+    // No longer listening, clean-up the server. Closing the listening sockets first means a new server process which
+    // received them in a handoff is now their only acceptor, then in-flight responses are given time to finish.
     // pthread attributes are copied into each thread, so it is safe to free the thread attributes instance, even if a
     // thread runs before calling close(sockfd) on the server socket.
     // https://pubs.opengroup.org/onlinepubs/009695399/functions/pthread_create.html (not code, just manpage).
     pthread_attr_destroy(&thread_attr);
-    close(sockfd);
+    for (int i = 0; i < n_listeners; i++) {
+        close(listeners[i]);
+    }
+    drain_clients(config->drain_secs);
 
+    // On a restart, the unix socket's path now belongs to the new server process, and the hot set was already saved for
+    // the new server process to warm up from.
+    if (config->unix_path != NULL && !is_handed_off) {
+        unix_path_unlink(config->unix_path);
+    }
+    if (config->is_recording_hotset && !is_handed_off) {
+        hotset_save(config->manifest_path);
+    }
     return 0;
 }
 
+// Accept a pending connection on a listening socket and hand it off to a new client thread.
+void accept_client(int sockfd, const server_config_t *config, const pthread_attr_t *thread_attr,
+                   const struct timeval *timeout) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_size = sizeof(client_addr);
+    int client_sockfd = accept(sockfd, (struct sockaddr *)&client_addr, &client_addr_size);
+    if (client_sockfd < 0) {
+        // Could not accept: continue accepting other connections. Listening sockets are non-blocking, since another
+        // server process sharing them during a restart may have accepted the connection first.
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("accept");
+        }
+        return;
+    }
+
+    // Set a receive timeout on the client socket before handing off to thread, and keep the socket from leaking into
+    // a restarted server process. Should never error out. A send timeout likewise bounds how long a client which stops
+    // reading can stall its response: without one, a stalled bulk response would keep its bulk slot forever, and
+    // enough of them would leave every later bulk response waiting.
+    const struct timeval send_timeout = {.tv_sec = SEND_TIMEOUT_SECS, .tv_usec = 0};
+    if (setsockopt(client_sockfd, SOL_SOCKET, SO_RCVTIMEO, timeout, sizeof(*timeout)) < 0 ||
+        setsockopt(client_sockfd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) < 0 ||
+        fcntl(client_sockfd, F_SETFD, FD_CLOEXEC) < 0) {
+        perror("setsockopt: client");
+        close(client_sockfd);
+        return;
+    }
+
+    // Prepare thread-local arguments for serving clients.
+    client_args_t *client_args = client_args_create(client_sockfd, config);
+    if (client_args == NULL) {
+        close(client_sockfd);
+        return;
+    }
+
+    // Spawn a detached thread to receive and process a client request, counting it as in-flight until it finishes.
+    pthread_mutex_lock(&clients_lock);
+    active_clients++;
+    pthread_mutex_unlock(&clients_lock);
+    pthread_t thread;
+    int err = pthread_create(&thread, thread_attr, client_thread, (void *)client_args);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        close(client_sockfd);
+        free(client_args);
+        pthread_mutex_lock(&clients_lock);
+        active_clients--;
+        pthread_mutex_unlock(&clients_lock);
+    }
+}
+
 // Thread function for receiving and processing client requests and orchestrating the delivery of responses.
 void *client_thread(void *arg) {
     // Unwrap thread arguments.
     client_args_t *client_args = (client_args_t *)arg;
     int client_sockfd = client_args->fd;
-    const char *s_root_path = client_args->root_path;
+    const server_config_t *config = client_args->config;
     free(client_args);
 
+    serve_client(client_sockfd, config);
+
+    // No longer in-flight: wake a draining main thread if this was the last client.
+    pthread_mutex_lock(&clients_lock);
+    if (--active_clients == 0) {
+        pthread_cond_signal(&clients_drained);
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return NULL;
+}
+
+// Receive a request from a client, send back the response, and close the connection.
+void serve_client(int client_sockfd, const server_config_t *config) {
     // Store received data in a buffer allocated on the stack for better locality and performance.
     request_t req = {.buffer = {'\0'},
                      .slash_ptr = NULL,
@@ -139,27 +310,49 @@ void *client_thread(void *arg) {
         // Received an error with the socket that was NOT because of a timeout - drop this client.
         perror("recv");
         close(client_sockfd);
-        return NULL;
+        return;
     }
 
     // count may not necessarily be zero here - e.g. received bytes successfully but stage = BAD due to early
-    // elimination of a malformed request. Make response - if bad request, return 400 response.
-    response_t *res = stage == VALID ? make_response(s_root_path, &req) : response_create_400();
+    // elimination of a malformed request. Make response - if bad request, return 400 response. Valid requests are
+    // served from the bundle if there is one, otherwise from the filesystem.
+    response_t *res;
+    if (stage != VALID) {
+        res = response_create_400();
+    } else if (config->bundle != NULL) {
+        res = make_bundle_response(config->bundle, &req);
+    } else {
+        res = make_response(config->root_path, config->is_autoindex, &req);
+    }
     if (res == NULL) {
         // Occurs only with malloc failure - drop the client.
         perror("null response");
         close(client_sockfd);
-        return NULL;
+        return;
+    }
+
+    // The body size is known before any byte is sent, so schedule the response into the small or bulk lane now.
+    lane_t lane = lane_enter(res->body_size);
+    if (lane == LANE_BULK) {
+        // Cap the unsent bytes a bulk response may queue in the kernel to about one chunk, so that yielding between
+        // chunks actually makes way for small responses. Fails harmlessly on unix sockets.
+        int lowat = LANE_BULK_CHUNK_BYTES;
+        setsockopt(client_sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
     }
 
     // Send header to client.
-    int bytes_sent = send_header(res, client_sockfd);
+    zerocopy_t zc = ZEROCOPY_INIT;
+    int bytes_sent = send_header(res, client_sockfd, config->zerocopy_threshold, &zc);
     // Send content only if sending headers was successful.
     if (bytes_sent == res->header_size && res->body_size > 0) {
         // Switch on either sending out a byte array (e.g. 400 message with Entity-Body) or a file.
         switch (res->status) {
         case HTTP_200:
-            send_fd_file(res, client_sockfd);
+            if (res->body_buffer != NULL) {
+                send_buffer(client_sockfd, res->body_buffer, res->body_size, config->zerocopy_threshold, &zc);
+            } else {
+                send_fd_file(res, client_sockfd, lane);
+            }
             break;
         default:
             // Other statuses have Content-Length: 0 for now.
@@ -167,40 +360,67 @@ void *client_thread(void *arg) {
         }
     }
 
-    // Finished sending: free response and close the connection.
+    // Finished sending, so give up the lane before anything else can hold it. The kernel may still be reading
+    // in-memory bytes which were sent without copying, so wait for it to release them before freeing the response and
+    // closing the connection. A client which stops acknowledging is given as long as an idle request before being reset.
+    lane_leave(lane);
+    zerocopy_wait(client_sockfd, &zc, RECV_TIMEOUT_SECS * MS_PER_SEC);
     response_free(res);
     close(client_sockfd);
-    return NULL;
+    return;
 }
 
 // Send the content of a header to a client. int types are fine since the headers in the server's response are bounded
 // by the Linux absolute path limit of 4096 characters.
-int send_header(response_t *res, int client_sockfd) {
-    int bytes_sent = 0, bytes_left = res->header_size, n;
-    while (bytes_sent < res->header_size) {
-        n = send(client_sockfd, res->header + bytes_sent, bytes_left, 0);
+int send_header(response_t *res, int client_sockfd, size_t zerocopy_threshold, zerocopy_t *zc) {
+    return send_buffer(client_sockfd, res->header, res->header_size, zerocopy_threshold, zc);
+}
+
+// Send bytes held in user memory to a client. Buffers of at least zerocopy_threshold bytes are sent with MSG_ZEROCOPY,
+// which skips copying them into the kernel, so must stay valid until zerocopy_wait() returns. A threshold of 0 always
+// copies.
+size_t send_buffer(int client_sockfd, const char *buf, size_t len, size_t zerocopy_threshold, zerocopy_t *zc) {
+    bool use_zerocopy = zerocopy_threshold > 0 && len >= zerocopy_threshold;
+    size_t bytes_sent = 0;
+    ssize_t n;
+    while (bytes_sent < len) {
+        if (use_zerocopy) {
+            n = zerocopy_send(client_sockfd, buf + bytes_sent, len - bytes_sent, zc);
+        } else {
+            n = send(client_sockfd, buf + bytes_sent, len - bytes_sent, 0);
+        }
         if (n < 0) {
-            perror("send: header error");
+            perror("send: buffer error");
             break;
         }
         bytes_sent += n;
-        bytes_left -= n;
     }
     return bytes_sent;
 }
 
 // Send binary file content to a client. On 64-bit systems and 32-bit systems with FILE_OFFSET_BITS=64 defined,
 // off_t, sendfile, open are automatically converted to their 64-bit versions, enabling Large File Support.
-off_t send_fd_file(response_t *res, int client_sockfd) {
+// Bulk bodies are sent in chunks, yielding to in-flight small responses between chunks.
+off_t send_fd_file(response_t *res, int client_sockfd, lane_t lane) {
     off_t bytes_sent_offset = 0L;
     off_t bytes_left = res->body_size;
     size_t count;
     ssize_t n;
+    // Bundled bodies share the bundle's fd between threads, so the fd's own offset cannot be used. Instead, sendfile()
+    // reads from and advances a local offset starting at the body, which must not also be advanced by n below.
+    off_t bundle_offset = res->body_offset;
+    off_t *offset_ptr = res->is_bundled ? &bundle_offset : NULL;
     while (bytes_sent_offset < res->body_size) {
         bytes_left = res->body_size - bytes_sent_offset;
         // n's narrower type & the limit of SSIZE_MAX comes from sendfile sending at most SSIZE_MAX bytes per call. With
         // sendfile, there's no need to pass in an offset, but the max number of bytes to send should still be tracked.
         count = bytes_left > SSIZE_MAX ? SSIZE_MAX : bytes_left;
+        if (lane == LANE_BULK) {
+            count = count > LANE_BULK_CHUNK_BYTES ? LANE_BULK_CHUNK_BYTES : count;
+            if (bytes_sent_offset > 0) {
+                lane_yield_bulk();
+            }
+        }
 
         // Why sendfile()?
         // sendfile() is more performant than the usual read() + send() loop. With read() + send(), we have to copy
@@ -217,12 +437,12 @@ off_t send_fd_file(response_t *res, int client_sockfd) {
         // multiple sendfile() calls are required. There is also no need to think about choosing a buffer that fits
         // within the stack or isn't too large for mallocing on the heap when there are many clients.
 
-        // Some implementation notes: since sendfile can update the offset of the file descriptor, you should NOT pass
-        // in an offset variable, but instead let the offset be NULL and let sendfile() update the fd's offset for you.
-        // https://linux.die.net/man/2/sendfile (not code, just manpage). If you erroneously pass in a non-null offset,
-        // you will notice that the returned bytes_send_offset will be double the correct value, but the actual offset
-        // used by sendfile will grow exponentially, leading to failed downloads on files >2GB.
-        n = sendfile(client_sockfd, res->body_fd, NULL, count);
+        // Some implementation notes: for a file of its own, pass a NULL offset and let sendfile() update the fd's
+        // offset for you. https://linux.die.net/man/2/sendfile (not code, just manpage). A non-null offset is instead
+        // read and advanced by sendfile() itself and the fd's offset is left alone, which bundles rely on above. Either
+        // way, the offset must never also be advanced by n here: doing so double counts every chunk and makes the
+        // offset grow exponentially, leading to failed downloads on files >2GB.
+        n = sendfile(client_sockfd, res->body_fd, offset_ptr, count);
         if (n <= 0) {
             perror("sendfile: 200 entity-body error");
             break;
@@ -233,30 +453,120 @@ off_t send_fd_file(response_t *res, int client_sockfd) {
 }
 
 // Safely create the arguments for a thread.
-client_args_t *client_args_create(int fd, const char *root_path) {
+client_args_t *client_args_create(int fd, const server_config_t *config) {
     client_args_t *args = malloc(sizeof(*args));
     if (args == NULL) {
         perror("client_args_create: malloc");
         return NULL;
     }
     args->fd = fd;
-    args->root_path = root_path;
+    args->config = config;
     return args;
 }
 
-// Signal handler function for termination, which flips a flag.
+// Re-execute the server binary and pass it the listening sockets. Returns the handoff socket to poll for the new
+// process's readiness, or -1 if the restart could not be started, in which case this process keeps serving.
+int handoff_begin(const server_config_t *config, const int *listeners, size_t n_listeners, pid_t *pid_dest) {
+    // Save the hot set first, so that the new server process warms up from this process's traffic.
+    if (config->is_recording_hotset) {
+        hotset_save(config->manifest_path);
+    }
+    int handoff_fd = handoff_spawn(config->exe_path, config->argv, pid_dest);
+    if (handoff_fd < 0) {
+        return -1;
+    }
+    if (handoff_send_fds(handoff_fd, listeners, n_listeners) < 0) {
+        // The new process sees the handoff socket close and exits.
+        close(handoff_fd);
+        waitpid(*pid_dest, NULL, 0);
+        return -1;
+    }
+    fprintf(stderr, "server: restarting, handed listening sockets to pid %ld.\n", (long)*pid_dest);
+    return handoff_fd;
+}
+
+// Wait for the new server process's acknowledgement. Returns true if it is now accepting connections, otherwise reaps
+// it and returns false so that this process keeps serving.
+bool handoff_finish(int handoff_fd, pid_t child_pid) {
+    char ack = '\0';
+    ssize_t n = recv(handoff_fd, &ack, sizeof(ack), 0);
+    close(handoff_fd);
+    if (n == sizeof(ack) && ack == HANDOFF_READY) {
+        return true;
+    }
+    fprintf(stderr, "server: restart failed, continuing to serve.\n");
+    // The new process only closes its end without acknowledging by exiting, so this wait is brief, but it must block:
+    // the end of the socket can be seen before the process has exited, and a non-blocking wait would leave a zombie.
+    waitpid(child_pid, NULL, 0);
+    return false;
+}
+
+// Wait for in-flight clients to finish receiving their responses, for at most drain_secs. Any clients still in-flight
+// after the deadline are cut off when main returns.
+void drain_clients(unsigned long drain_secs) {
+    // pthread_cond_timedwait() takes an absolute deadline on the realtime clock.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += drain_secs;
+
+    pthread_mutex_lock(&clients_lock);
+    while (active_clients > 0) {
+        if (pthread_cond_timedwait(&clients_drained, &clients_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    unsigned long remaining = active_clients;
+    pthread_mutex_unlock(&clients_lock);
+
+    if (remaining > 0) {
+        fprintf(stderr, "server: drain deadline reached with %lu clients in-flight.\n", remaining);
+    }
+}
+
+// Signal handler function for termination and restarts, which flips a flag and wakes the main loop. A second
+// termination signal exits immediately. Restarts are ignored once draining, e.g. after handing off to a new server
+// process, so that a further deploy or a SIGHUP sent to every server process does not cut off responses in flight.
 static void termination_handler(int signum) {
-    is_listening = false;
+    if (signum == SIGHUP) {
+        if (!is_listening) {
+            return;
+        }
+        is_restarting = true;
+    } else {
+        if (is_terminating) {
+            _exit(EXIT_FAILURE);
+        }
+        is_terminating = true;
+        is_listening = false;
+    }
+
+    // write() is async-signal-safe, but may clobber errno for the interrupted code.
+    int saved_errno = errno;
+    if (write(signal_pipe[1], "", 1) < 0) {
+        // The pipe is full, so the main loop is already due to wake up.
+    }
+    errno = saved_errno;
     return;
 }
 
 // Register signal handlers.
 void setup_signal_handling() {
-    // Register signal handler for termination.
+    // Create the non-blocking self-pipe used to wake the main loop.
+    if (pipe(signal_pipe) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    // Register signal handler for termination and restarts. Interrupted system calls in client threads are restarted,
+    // so that in-flight responses keep sending while the server drains.
     struct sigaction new_action;
     new_action.sa_handler = termination_handler;
     sigemptyset(&new_action.sa_mask);
-    new_action.sa_flags = 0;
+    new_action.sa_flags = SA_RESTART;
     sigaction(SIGINT, &new_action, NULL);
     sigaction(SIGTERM, &new_action, NULL);
     sigaction(SIGHUP, &new_action, NULL);
@@ -274,7 +584,7 @@ int socket_new(const uint8_t protocol, const char *port) {
     // Provide hints for socket intialisation.
     struct addrinfo hints, *result;
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = protocol == 6 ? AF_INET6 : AF_INET;
+    hints.ai_family = protocol == 4 ? AF_INET : AF_INET6;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
     int s = getaddrinfo(NULL, port, &hints, &result);
@@ -294,8 +604,9 @@ int socket_new(const uint8_t protocol, const char *port) {
             continue;
         }
 
-        // Open socket file descriptor.
-        sockfd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        // Open socket file descriptor. Non-blocking, since a restarted server process may share it and win the race to
+        // accept a connection, and close-on-exec, since it is passed to a restarted process explicitly.
+        sockfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol);
         if (sockfd < 0) {
             perror("socket");
             continue;
@@ -309,8 +620,20 @@ int socket_new(const uint8_t protocol, const char *port) {
             continue;
         }
 
+        // Dual-stack listeners also accept IPv4 clients, so that one process and its caches serve both families.
+        // Otherwise, IPv6 listeners are IPv6-only regardless of the system default, so an IPv4 server may share the
+        // port.
+        if (p->ai_family == AF_INET6) {
+            int v6only = protocol != PROTOCOL_DUAL_STACK;
+            if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+                perror("setsockopt: IPV6_V6ONLY");
+                close(sockfd);
+                continue;
+            }
+        }
+
         // Bind address to socket.
-        if (bind(sockfd, result->ai_addr, result->ai_addrlen) < 0) {
+        if (bind(sockfd, p->ai_addr, p->ai_addrlen) < 0) {
             perror("bind");
             close(sockfd);
             continue;
@@ -333,4 +656,77 @@ int socket_new(const uint8_t protocol, const char *port) {
         exit(EXIT_FAILURE);
     }
     return sockfd;
-}
\ No newline at end of file
+}
+// Establishes a unix domain socket for listening, for co-located reverse proxies which would otherwise pay for the TCP
+// stack over loopback. Requests and sendfile() work the same over either kind of socket.
+int socket_unix_new(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "server: unix socket path is too long.\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    // Remove a socket left behind by a server which did not shut down cleanly, but never any other kind of file, nor the
+    // socket of a server still listening on it. As for TCP ports, a socket in use is an error.
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (!is_unix_socket_stale(&addr)) {
+            fprintf(stderr, "server: unix socket %s is in use.\n", path);
+            exit(EXIT_FAILURE);
+        }
+        unlink(path);
+    }
+
+    // Non-blocking and close-on-exec for the same reasons as TCP listening sockets.
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("socket: unix");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind: unix");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(sockfd, LISTEN_QUEUE_SIZE) < 0) {
+        perror("listen: unix");
+        exit(EXIT_FAILURE);
+    }
+    unix_path_remember(path);
+    return sockfd;
+}
+
+// True if nothing is listening on the socket at addr, i.e. connecting is refused. Connecting is non-blocking, so a
+// live server with a full accept queue is reported as in use rather than waited on.
+bool is_unix_socket_stale(const struct sockaddr_un *addr) {
+    int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe_fd < 0) {
+        perror("socket: unix probe");
+        exit(EXIT_FAILURE);
+    }
+    bool is_stale = connect(probe_fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 && errno == ECONNREFUSED;
+    close(probe_fd);
+    return is_stale;
+}
+
+// Records which file the unix socket's path currently names, as the socket this process listens on.
+void unix_path_remember(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        perror("lstat: unix");
+        return;
+    }
+    unix_path_dev = st.st_dev;
+    unix_path_ino = st.st_ino;
+    has_unix_path_id = true;
+}
+
+// Removes the unix socket's path, unless it has since been replaced by another server's socket.
+void unix_path_unlink(const char *path) {
+    struct stat st;
+    if (has_unix_path_id && lstat(path, &st) == 0 && st.st_dev == unix_path_dev && st.st_ino == unix_path_ino) {
+        unlink(path);
+    }
+}
@@ -1,13 +1,49 @@
 #ifndef SERVER_LOOPER_H
 #define SERVER_LOOPER_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "bundle.h"
+
 // All network-related system calls are orchestrated in server_looper.c - this achieves good separation of
 // concerns. We handoff request data processing work to functions in other modules as necessary. sendfile() benefits
 // are described at the call site.
 
+// Protocol number for a single listener accepting both IPv6 and IPv4 (as IPv4-mapped IPv6 addresses).
+#define PROTOCOL_DUAL_STACK 46
+
+// Server settings, read from the command line in server.c.
+typedef struct server_config_t {
+    // 4, 6 or PROTOCOL_DUAL_STACK.
+    uint8_t protocol;
+    // TCP port, or NULL to listen only on unix_path.
+    const char *port;
+    // Path of a unix domain socket to also listen on, or NULL.
+    const char *unix_path;
+    const char *root_path;
+    // Set when the web root is a bundle built by ./pack, in which case it is served instead of the filesystem.
+    const bundle_t *bundle;
+    // Whether directories without an index.html are served as listings. Not supported for bundles.
+    bool is_autoindex;
+    // Seconds to wait for in-flight responses to finish when shutting down or restarting.
+    unsigned long drain_secs;
+    // Number of bulk responses which may be sent at once. See lanes.h.
+    unsigned long bulk_slots;
+    // In-memory sends of at least this many bytes use MSG_ZEROCOPY, or never if 0. See zerocopy.h.
+    size_t zerocopy_threshold;
+    // Manifest of hot paths to prefetch at startup, or NULL. If is_recording_hotset, the paths served most often are
+    // saved back to it before shutting down or restarting.
+    const char *manifest_path;
+    bool is_recording_hotset;
+    unsigned long warmup_budget_ms;
+    // The server binary's absolute path and its argument vector, used to re-execute it on a restart.
+    const char *exe_path;
+    char **argv;
+} server_config_t;
+
 // The main loop of the HTTP server.
-int server_loop(uint8_t s_protocol, const char *s_port, const char *s_root_path);
+int server_loop(const server_config_t *config);
 
 #endif // !SERVER_LOOPER_H
@@ -1,6 +1,7 @@
 # Environment variables and constants for automated server spawning and running unit tests.
 
 SERVER: str = "./server"
+PACK: str = "./pack"
 IP_VER: int = 4
 PORT: int = 9000
 ROOT: str = "./www1"
@@ -0,0 +1,346 @@
+# Concurrency and latency regression tests. Runs mixed workloads against the server under concurrency, verifies every
+# body byte-for-byte, and compares requests per second and p99 latencies against a baseline recorded on the same
+# machine, failing if a change regresses past a tolerance.
+
+from concurrent.futures import ThreadPoolExecutor
+import hashlib
+import json
+import os
+import random
+import shutil
+import signal
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+import unittest
+
+from test_env import *
+
+SKIP_LARGE_FILES = True
+# Rewrites the baseline with this run's results instead of comparing against it. A missing baseline is always written.
+UPDATE_BASELINE = os.environ.get("UPDATE_BASELINE") == "1"
+BASELINE_PATH: str = "load_baseline.json"
+# Fractions by which requests per second may drop, and p99 latency rise, before a test fails.
+RPS_TOLERANCE: float = 0.25
+P99_TOLERANCE: float = 0.5
+
+PROJ2_ROOT: str = "./proj2_testcases/www/hidden"
+# Each workload is repeated, keeping its best round, since a single round is noisy on shared machines.
+ROUNDS: int = 3
+CLIENTS: int = 32
+SMALL_REQUESTS: int = 4000
+TRICKLE_CLIENTS: int = 8
+TRICKLE_BYTE_DELAY_SECS: float = 0.001
+NOT_FOUND_REQUESTS: int = 4000
+LARGE_DOWNLOADS: int = 2
+LARGE_FILE_SIZE: int = (2 << 30) + 12345
+LARGE_BLOCK_SIZE: int = 1 << 20
+RECV_SIZE: int = 1 << 16
+SERVER_START_TIMEOUT_SECS: float = 5.0
+
+NOT_FOUND_PATHS = [
+    "/nope.html",
+    "/assets/nope.js",
+    "/assets",
+    "/../www1/index.html",
+    "/subdir/../index.html",
+    "/..",
+    "/lectures",
+    "/tricky/..",
+    "/" + "x" * 255,
+]
+
+
+def connect(port: int) -> socket.socket:
+    addr = "::1" if IP_VER == 6 else "127.0.0.1"
+    return socket.create_connection((addr, port))
+
+
+def parse_response(response: bytes):
+    """Returns the status code, headers and body of a whole HTTP/1.0 response."""
+    head, _, body = response.partition(b"\r\n\r\n")
+    lines = head.decode("ascii").split("\r\n")
+    status = int(lines[0].split(" ")[1])
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip()
+    return status, headers, body
+
+
+def fetch(port: int, path: str, trickle_delay: float = 0.0):
+    """Makes one request on a new connection, sending it one byte at a time if trickle_delay is set. Returns the
+    status, headers and body, and the latency in seconds."""
+    request = ("GET " + path + " HTTP/1.0\r\n\r\n").encode("ascii")
+    start = time.perf_counter()
+    sock = connect(port)
+    if trickle_delay > 0:
+        for i in range(len(request)):
+            sock.sendall(request[i : i + 1])
+            time.sleep(trickle_delay)
+    else:
+        sock.sendall(request)
+    chunks = []
+    while True:
+        chunk = sock.recv(RECV_SIZE)
+        if not chunk:
+            break
+        chunks.append(chunk)
+    sock.close()
+    latency = time.perf_counter() - start
+    return parse_response(b"".join(chunks)), latency
+
+
+def fetch_digest(port: int, path: str):
+    """Downloads a body without keeping it in memory. Returns the status, Content-Length, the number of body bytes
+    received and their SHA-256."""
+    sock = connect(port)
+    sock.sendall(("GET " + path + " HTTP/1.0\r\n\r\n").encode("ascii"))
+    head = b""
+    while b"\r\n\r\n" not in head:
+        chunk = sock.recv(RECV_SIZE)
+        if not chunk:
+            break
+        head += chunk
+    head, _, body = head.partition(b"\r\n\r\n")
+    status, headers, _ = parse_response(head + b"\r\n\r\n")
+    digest = hashlib.sha256(body)
+    received = len(body)
+    while True:
+        chunk = sock.recv(RECV_SIZE)
+        if not chunk:
+            break
+        digest.update(chunk)
+        received += len(chunk)
+    sock.close()
+    return status, int(headers.get("content-length", -1)), received, digest.hexdigest()
+
+
+def collect_files(root: str):
+    """Maps the request path of every regular file under root to its contents. Paths which would need escaping in a
+    request line are left out."""
+    files = {}
+    for dirpath, _, filenames in os.walk(root):
+        for filename in filenames:
+            fs_path = os.path.join(dirpath, filename)
+            uri = "/" + os.path.relpath(fs_path, root)
+            if not uri.isascii() or any(c in uri for c in " %?#") or "inaccessible" in uri:
+                continue
+            if not os.path.isfile(fs_path) or not os.access(fs_path, os.R_OK):
+                continue
+            with open(fs_path, "rb") as f:
+                files[uri] = f.read()
+    return files
+
+
+def percentile(latencies, fraction: float) -> float:
+    ordered = sorted(latencies)
+    return ordered[int(fraction * (len(ordered) - 1))]
+
+
+def start_server(port: int, root: str) -> subprocess.Popen:
+    """Launches the server and waits until it accepts connections."""
+    server = subprocess.Popen([SERVER, str(IP_VER), str(port), root])
+    deadline = time.monotonic() + SERVER_START_TIMEOUT_SECS
+    while time.monotonic() < deadline:
+        try:
+            connect(port).close()
+            return server
+        except ConnectionRefusedError:
+            time.sleep(0.01)
+    server.kill()
+    raise RuntimeError("server did not start listening on port " + str(port))
+
+
+def stop_server(server: subprocess.Popen):
+    server.send_signal(signal.SIGINT)
+    server.wait()
+
+
+def write_large_file(path: str) -> str:
+    """Writes a file of LARGE_FILE_SIZE bytes in which every block is numbered, so that misplaced bytes change its
+    digest. Returns its SHA-256."""
+    digest = hashlib.sha256()
+    pattern = random.Random(0).getrandbits(8 * LARGE_BLOCK_SIZE).to_bytes(LARGE_BLOCK_SIZE, "little")
+    with open(path, "wb") as f:
+        for offset in range(0, LARGE_FILE_SIZE, LARGE_BLOCK_SIZE):
+            block = (offset // LARGE_BLOCK_SIZE).to_bytes(8, "little") + pattern[8:]
+            block = block[: LARGE_FILE_SIZE - offset]
+            f.write(block)
+            digest.update(block)
+    return digest.hexdigest()
+
+
+class TestLoadRegression(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls) -> None:
+        cls.results = {}
+        cls.baseline = {}
+        if os.path.exists(BASELINE_PATH) and not UPDATE_BASELINE:
+            with open(BASELINE_PATH) as f:
+                cls.baseline = json.load(f)
+
+        cls.files = {PORT: collect_files(ROOT), PORT + 1: collect_files(PROJ2_ROOT)}
+        cls.servers = [start_server(PORT, ROOT), start_server(PORT + 1, PROJ2_ROOT)]
+        # Warm the page cache, so the first workload does not pay for it.
+        for port in cls.files:
+            for path in cls.files[port]:
+                fetch(port, path)
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        for server in cls.servers:
+            stop_server(server)
+        # Workloads without a baseline yet, e.g. large files run for the first time, are added to it. Workloads which
+        # did not run this time keep their baseline.
+        merged = {}
+        if os.path.exists(BASELINE_PATH):
+            with open(BASELINE_PATH) as f:
+                merged = json.load(f)
+        new_results = {w: r for w, r in cls.results.items() if UPDATE_BASELINE or w not in merged}
+        if new_results:
+            merged.update(new_results)
+            with open(BASELINE_PATH, "w") as f:
+                json.dump(merged, f, indent=4, sort_keys=True)
+                f.write("\n")
+
+    def check_ok(self, port: int, path: str, response):
+        status, headers, body = response
+        self.assertEqual(HTTP_200, status, path)
+        self.assertEqual(str(len(body)), headers["content-length"], path)
+        self.assertTrue(body == self.files[port][path], path + ": body differs from the file")
+
+    def check_not_found(self, path: str, response):
+        status, headers, body = response
+        self.assertEqual(HTTP_404, status, path)
+        self.assertEqual("0", headers["content-length"], path)
+        self.assertEqual(b"", body, path)
+
+    def record(self, workload: str, rounds):
+        """Records the best of a workload's rounds, each of requests per second and latencies, failing if they
+        regressed past the tolerance from the baseline."""
+        rps = max(round_rps for round_rps, _ in rounds)
+        p99_ms = min(percentile(latencies, 0.99) for _, latencies in rounds) * 1000
+        self.results[workload] = {"rps": round(rps, 3), "p99_ms": round(p99_ms, 3)}
+        print(f"\n{workload}: {rps:.1f} req/s, p99 {p99_ms:.2f} ms", end=" ")
+        if workload not in self.baseline:
+            return
+        base = self.baseline[workload]
+        self.assertGreaterEqual(
+            rps, base["rps"] * (1 - RPS_TOLERANCE), f"{workload}: req/s regressed from {base['rps']} to {rps:.1f}"
+        )
+        self.assertLessEqual(
+            p99_ms,
+            base["p99_ms"] * (1 + P99_TOLERANCE),
+            f"{workload}: p99 regressed from {base['p99_ms']} ms to {p99_ms:.3f} ms",
+        )
+
+    def run_concurrently(self, jobs, clients: int = CLIENTS):
+        """Runs (port, path) jobs across concurrent clients. Returns requests per second, and each job's response and
+        latency in order."""
+        start = time.perf_counter()
+        with ThreadPoolExecutor(max_workers=clients) as pool:
+            outcomes = list(pool.map(lambda job: fetch(*job), jobs))
+        elapsed = time.perf_counter() - start
+        return len(jobs) / elapsed, outcomes
+
+    def test_small_files(self):
+        """Many concurrent requests for the small files of both web roots."""
+        rng = random.Random(1)
+        paths = [(port, path) for port in self.files for path in self.files[port]]
+        rounds = []
+        for _ in range(ROUNDS):
+            jobs = [rng.choice(paths) for _ in range(SMALL_REQUESTS)]
+            rps, outcomes = self.run_concurrently(jobs)
+            for (port, path), (response, _) in zip(jobs, outcomes):
+                self.check_ok(port, path, response)
+            rounds.append((rps, [latency for _, latency in outcomes]))
+        self.record("small_files", rounds)
+
+    def test_slow_trickle(self):
+        """Clients sending their request one byte at a time must not hold up concurrent fast clients."""
+        rng = random.Random(2)
+        paths = [(port, path) for port in self.files for path in self.files[port]]
+        rounds = []
+        for _ in range(ROUNDS):
+            # Trickling clients keep starting new requests until the fast clients are done, so every round sees the
+            # same contention.
+            is_done = threading.Event()
+            trickle_outcomes = [[] for _ in range(TRICKLE_CLIENTS)]
+
+            def trickle(i):
+                trickle_rng = random.Random(i)
+                while not is_done.is_set():
+                    port, path = trickle_rng.choice(paths)
+                    trickle_outcomes[i].append((port, path, fetch(port, path, TRICKLE_BYTE_DELAY_SECS)[0]))
+
+            threads = [threading.Thread(target=trickle, args=(i,)) for i in range(TRICKLE_CLIENTS)]
+            for thread in threads:
+                thread.start()
+            jobs = [rng.choice(paths) for _ in range(SMALL_REQUESTS)]
+            rps, outcomes = self.run_concurrently(jobs, CLIENTS - TRICKLE_CLIENTS)
+            is_done.set()
+            for thread in threads:
+                thread.join()
+
+            for (port, path), (response, _) in zip(jobs, outcomes):
+                self.check_ok(port, path, response)
+            for port, path, response in sum(trickle_outcomes, []):
+                self.check_ok(port, path, response)
+            rounds.append((rps, [latency for _, latency in outcomes]))
+        self.record("slow_trickle", rounds)
+
+    def test_not_found_storm(self):
+        """A storm of 404s and path escapes, interleaved with valid requests which must still be served correctly."""
+        rng = random.Random(3)
+        valid = [(PORT, path) for path in self.files[PORT]]
+        rounds = []
+        for _ in range(ROUNDS):
+            jobs = [(PORT, rng.choice(NOT_FOUND_PATHS)) if i % 8 else rng.choice(valid) for i in range(NOT_FOUND_REQUESTS)]
+            rps, outcomes = self.run_concurrently(jobs)
+            for (port, path), (response, _) in zip(jobs, outcomes):
+                if path in NOT_FOUND_PATHS:
+                    self.check_not_found(path, response)
+                else:
+                    self.check_ok(port, path, response)
+            rounds.append((rps, [latency for _, latency in outcomes]))
+        self.record("not_found_storm", rounds)
+
+    @unittest.skipIf(SKIP_LARGE_FILES, "")
+    def test_large_parallel(self):
+        """Parallel downloads of a file over 2 GiB, whose offsets overflow 32 bits. Recorded as downloads per second,
+        with p99 as the slowest download."""
+        root = tempfile.mkdtemp(prefix="http-server-load-")
+        try:
+            expected_digest = write_large_file(os.path.join(root, "large.bin"))
+            server = start_server(PORT + 2, root)
+            try:
+                start = time.perf_counter()
+                latencies = []
+
+                def download(_):
+                    t = time.perf_counter()
+                    result = fetch_digest(PORT + 2, "/large.bin")
+                    latencies.append(time.perf_counter() - t)
+                    return result
+
+                with ThreadPoolExecutor(max_workers=LARGE_DOWNLOADS) as pool:
+                    results = list(pool.map(download, range(LARGE_DOWNLOADS)))
+                elapsed = time.perf_counter() - start
+            finally:
+                stop_server(server)
+        finally:
+            shutil.rmtree(root)
+
+        for status, content_length, received, digest in results:
+            self.assertEqual(HTTP_200, status)
+            self.assertEqual(LARGE_FILE_SIZE, content_length)
+            self.assertEqual(LARGE_FILE_SIZE, received)
+            self.assertEqual(expected_digest, digest)
+        self.record("large_parallel", [(LARGE_DOWNLOADS / elapsed, latencies)])
+
+
+if __name__ == "__main__":
+    unittest.main()
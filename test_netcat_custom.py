@@ -259,6 +259,24 @@ class TestNetcat(unittest.TestCase):
         nc.recv()
         nc.close()
 
+    def test_a7_malformed_percent_escape_400(self):
+        nc = ncstart()
+        nc.send("GET /index.html%2 HTTP/1.0\r\n\r\n")
+
+        res = nc.recv()
+        self.status_in_header(HTTP_400_TEXT, res)
+
+        nc.close()
+
+    def test_a8_percent_escaped_control_character_400(self):
+        nc = ncstart()
+        nc.send("GET /index.html%0A HTTP/1.0\r\n\r\n")
+
+        res = nc.recv()
+        self.status_in_header(HTTP_400_TEXT, res)
+
+        nc.close()
+
 
 if __name__ == "__main__":
     # print(FULL[2:31])
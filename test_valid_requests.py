@@ -1,17 +1,32 @@
 # Unit tests for well-formed requests.
 
+import calendar
 from dataclasses import dataclass
+import os
+import random
+import re
+import shutil
 import signal
+import socket
 from typing import Optional
 import unittest
 import subprocess
-import subprocess
+import tempfile
+import threading
 import time
 import requests
 
 from test_env import *
 
 SKIP_LARGE_FILES = True
+SERVER_START_TIMEOUT_SECS = 5.0
+# The server's send timeout, after which a response to a client which stopped reading is abandoned. sendfile() may
+# wait it out more than once for the same chunk, so a stalled response can take a few timeouts to be abandoned.
+SEND_TIMEOUT_SECS = 10
+SEND_TIMEOUTS_TO_ABANDON = 4
+# IMF-fixdate, as sent in Date and Last-Modified.
+HTTP_DATE_FORMAT = "%a, %d %b %Y %H:%M:%S GMT"
+DATE_TOLERANCE_SECS = 5
 
 
 @dataclass
@@ -28,6 +43,30 @@ class Request:
         self.path = "http://" + addr + ":" + str(PORT) + self.path
 
 
+def connect(port: int = PORT, ip_ver: int = IP_VER) -> socket.socket:
+    addr = "::1" if ip_ver == 6 else "127.0.0.1"
+    return socket.create_connection((addr, port))
+
+
+def spawn_server(args, port: int = PORT, stderr=None, ip_ver: int = IP_VER) -> subprocess.Popen:
+    """Starts the server with options and positional args, then waits until it accepts connections on port."""
+    server = subprocess.Popen([SERVER] + args, stderr=stderr)
+    deadline = time.monotonic() + SERVER_START_TIMEOUT_SECS
+    while time.monotonic() < deadline:
+        try:
+            connect(port, ip_ver).close()
+            return server
+        except ConnectionRefusedError:
+            time.sleep(0.01)
+    server.kill()
+    raise RuntimeError("server did not start listening on port " + str(port))
+
+
+def stop_server(server: subprocess.Popen):
+    server.send_signal(signal.SIGINT)
+    server.wait()
+
+
 class TestValidRequests(unittest.TestCase):
     @classmethod
     def setUpClass(cls) -> None:
@@ -142,6 +181,42 @@ class TestValidRequests(unittest.TestCase):
         )
         self.valid_helper(req)
 
+    def test_root_dir_index(self):
+        req = Request(
+            path="/",
+            code=HTTP_200,
+            size=251,
+            mime=MIME_HTML,
+        )
+        self.valid_helper(req)
+
+    def test_dir_without_index_404(self):
+        req = Request(
+            path="/subdir/",
+            code=HTTP_404,
+            size=0,
+            mime=None,
+        )
+        self.valid_helper(req)
+
+    def test_percent_encoded(self):
+        req = Request(
+            path="/index%2Ehtml",
+            code=HTTP_200,
+            size=251,
+            mime=MIME_HTML,
+        )
+        self.valid_helper(req)
+
+    def test_percent_encoded_path_escape(self):
+        req = Request(
+            path="/subdir/%2E%2E/index.html",
+            code=HTTP_404,
+            size=0,
+            mime=None,
+        )
+        self.valid_helper(req)
+
     def test_file_404(self):
         req = Request(
             path="/assets/bababoowee.js",
@@ -260,6 +335,15 @@ class TestValidRequests(unittest.TestCase):
         )
         self.valid_helper(req)
 
+    def test_dot_after_file_404(self):
+        req = Request(
+            path="/index.html/.",
+            code=HTTP_404,
+            size=0,
+            mime=None,
+        )
+        self.valid_helper(req)
+
     def test_post_invalid_400(self):
         req = Request(
             path="/api/v1/playMusic",
@@ -282,10 +366,483 @@ class TestValidRequests(unittest.TestCase):
         self.assertEqual(req.size, len(r.content))
         if r.status_code == HTTP_200:
             self.assertEqual(req.mime, r.headers["content-type"])
+            self.assertIn("last-modified", r.headers)
+        self.assertEqual("http-server", r.headers["server"])
+        self.assertEqual("close", r.headers["connection"])
+        self.assertNotIn("cache-control", r.headers)
+        date = calendar.timegm(time.strptime(r.headers["date"], HTTP_DATE_FORMAT))
+        self.assertLess(abs(date - time.time()), DATE_TOLERANCE_SECS)
 
     @classmethod
     def tearDownClass(cls) -> None:
         cls.server.send_signal(signal.SIGINT)
+        cls.server.wait()
+
+
+class TestValidRequestsBundled(TestValidRequests):
+    """Repeats every request against the web root packed into a bundle, which must answer exactly as the filesystem."""
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        cls.bundle_dir = tempfile.mkdtemp()
+        bundle_path = os.path.join(cls.bundle_dir, "www1.bundle")
+        subprocess.run([PACK, ROOT, bundle_path], check=True, stdout=subprocess.DEVNULL)
+        cls.server = subprocess.Popen(
+            [
+                SERVER,
+                str(IP_VER),
+                str(PORT),
+                bundle_path,
+            ]
+        )
+        time.sleep(0.01)
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        super().tearDownClass()
+        shutil.rmtree(cls.bundle_dir)
+
+
+class TestCachePolicy(unittest.TestCase):
+    """Sends the Cache-Control policy of the most specific -c rule with 200 responses, and none with errors."""
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        policies = [".css=max-age=86400", ".html=max-age=60", "*=no-cache"]
+        args = [arg for policy in policies for arg in ("-c", policy)]
+        cls.server = spawn_server(args + [str(IP_VER), str(PORT), ROOT])
+
+    def cache_control(self, path: str, code: int = HTTP_200) -> Optional[str]:
+        r = requests.get(Request(path, code, 0, None).path)
+        self.assertEqual(code, r.status_code)
+        return r.headers.get("cache-control")
+
+    def test_extension_policy(self):
+        self.assertEqual("max-age=86400", self.cache_control("/assets/styles.css"))
+        self.assertEqual("max-age=60", self.cache_control("/subdir/other.html"))
+
+    def test_default_policy(self):
+        self.assertEqual("no-cache", self.cache_control("/image.jpg"))
+        self.assertEqual("no-cache", self.cache_control("/special/html"))
+
+    def test_directory_takes_html_policy(self):
+        self.assertEqual("max-age=60", self.cache_control("/"))
+
+    def test_errors_have_no_policy(self):
+        self.assertIsNone(self.cache_control("/missing.css", HTTP_404))
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        stop_server(cls.server)
+
+
+class TestHttpDate(unittest.TestCase):
+    """Checks the server's own date formatting against strftime(), by serving a file with many modification times and
+    comparing its Last-Modified header."""
+
+    # Boundaries of months, leap days and the century rules, then random times up to the end of 2400.
+    BOUNDARIES = [
+        (1970, 1, 1, 0, 0, 0),
+        (1999, 12, 31, 23, 59, 59),
+        (2000, 2, 29, 12, 0, 0),
+        (2000, 3, 1, 0, 0, 0),
+        (2024, 2, 29, 23, 59, 59),
+        (2038, 1, 19, 3, 14, 8),
+        (2100, 2, 28, 23, 59, 59),
+        (2100, 3, 1, 0, 0, 0),
+        (2400, 2, 29, 0, 0, 0),
+    ]
+    N_RANDOM_TIMES = 200
+    LATEST = (2400, 12, 31, 23, 59, 59)
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        cls.root = tempfile.mkdtemp()
+        cls.file = os.path.join(cls.root, "dated.txt")
+        with open(cls.file, "w") as f:
+            f.write("dated")
+        cls.server = spawn_server([str(IP_VER), str(PORT), cls.root])
+
+    def test_last_modified_matches_strftime(self):
+        rng = random.Random(0)
+        times = [calendar.timegm(boundary) for boundary in self.BOUNDARIES]
+        times += [rng.randrange(calendar.timegm(self.LATEST)) for _ in range(self.N_RANDOM_TIMES)]
+        url = Request("/dated.txt", HTTP_200, 0, None).path
+        for t in times:
+            os.utime(self.file, (t, t))
+            r = requests.get(url)
+            self.assertEqual(HTTP_200, r.status_code)
+            self.assertEqual(time.strftime(HTTP_DATE_FORMAT, time.gmtime(t)), r.headers["last-modified"])
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        stop_server(cls.server)
+        shutil.rmtree(cls.root)
+
+
+class TestHotset(unittest.TestCase):
+    """Records the most requested paths with -R, which must be saved to the -w manifest hottest first, under their
+    canonical spelling, and without paths which were not served with a 200."""
+
+    def setUp(self) -> None:
+        self.manifest_dir = tempfile.mkdtemp()
+        self.manifest = os.path.join(self.manifest_dir, "hot.txt")
+        self.server = spawn_server(["-a", "-w", self.manifest, "-R", str(IP_VER), str(PORT), ROOT])
+
+    def get_status(self, path: str) -> int:
+        """Requests a path as spelt, since a client library would remove its dot segments."""
+        sock = connect()
+        sock.sendall(b"GET " + path.encode() + b" HTTP/1.0\r\n\r\n")
+        response = b""
+        while chunk := sock.recv(4096):
+            response += chunk
+        sock.close()
+        return int(response.split(b" ")[1])
+
+    def test_records_canonical_paths_hottest_first(self):
+        requested = {
+            "/index.html": 4,
+            "/./subdir//other.html": 2,
+            "/subdir/other.html": 1,
+            "/special/./": 2,
+            "/assets/styles.css": 1,
+        }
+        for path, count in requested.items():
+            for _ in range(count):
+                self.assertEqual(HTTP_200, self.get_status(path))
+        self.assertEqual(HTTP_404, self.get_status("/missing.html"))
+        stop_server(self.server)
+
+        with open(self.manifest) as f:
+            paths = f.read().splitlines()
+        self.assertEqual(["/index.html", "/subdir/other.html", "/special/"], paths[:3])
+        self.assertEqual(["/assets/styles.css"], paths[3:])
+
+    def tearDown(self) -> None:
+        if self.server.poll() is None:
+            stop_server(self.server)
+        shutil.rmtree(self.manifest_dir)
+
+
+class TestUnixSocket(unittest.TestCase):
+    """Serves over a unix domain socket with -u, replacing a stale socket file but refusing one another server is
+    listening on, and removing its own on shutdown."""
+
+    def setUp(self) -> None:
+        self.sock_dir = tempfile.mkdtemp()
+        self.sock_path = os.path.join(self.sock_dir, "server.sock")
+        self.servers = []
+
+    def spawn_unix_server(self) -> subprocess.Popen:
+        """Starts a server listening only on the unix socket, then waits until it accepts connections."""
+        server = subprocess.Popen([SERVER, "-u", self.sock_path, str(IP_VER), "-", ROOT])
+        self.servers.append(server)
+        deadline = time.monotonic() + SERVER_START_TIMEOUT_SECS
+        while time.monotonic() < deadline:
+            try:
+                self.unix_connect().close()
+                return server
+            except (FileNotFoundError, ConnectionRefusedError):
+                time.sleep(0.01)
+        self.fail("server did not start listening on " + self.sock_path)
+
+    def unix_connect(self) -> socket.socket:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(self.sock_path)
+        except OSError:
+            sock.close()
+            raise
+        return sock
+
+    def unix_get(self, path: str) -> bytes:
+        sock = self.unix_connect()
+        sock.sendall(b"GET " + path.encode() + b" HTTP/1.0\r\n\r\n")
+        response = b""
+        while chunk := sock.recv(4096):
+            response += chunk
+        sock.close()
+        return response
+
+    def assert_serves_index(self):
+        header, _, body = self.unix_get("/index.html").partition(b"\r\n\r\n")
+        self.assertTrue(header.startswith(b"HTTP/1.0 200 OK\r\n"))
+        with open(os.path.join(ROOT, "index.html"), "rb") as f:
+            self.assertEqual(f.read(), body)
+
+    def test_serves_file_without_port(self):
+        self.spawn_unix_server()
+        self.assert_serves_index()
+        with self.assertRaises(ConnectionRefusedError):
+            connect()
+
+    def test_refuses_path_in_use(self):
+        self.spawn_unix_server()
+        second = subprocess.run([SERVER, "-u", self.sock_path, str(IP_VER), "-", ROOT], stderr=subprocess.PIPE,
+                                timeout=SERVER_START_TIMEOUT_SECS)
+        self.assertEqual(1, second.returncode)
+        self.assertIn(b"is in use", second.stderr)
+        self.assert_serves_index()
+
+    def test_replaces_stale_socket(self):
+        stale = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        stale.bind(self.sock_path)
+        stale.close()
+        self.spawn_unix_server()
+        self.assert_serves_index()
+
+    def test_removes_socket_on_shutdown(self):
+        stop_server(self.spawn_unix_server())
+        self.assertFalse(os.path.exists(self.sock_path))
+
+    def tearDown(self) -> None:
+        for server in self.servers:
+            if server.poll() is None:
+                stop_server(server)
+        shutil.rmtree(self.sock_dir)
+
+
+class TestDualStack(unittest.TestCase):
+    """Serves IPv4 and IPv6 clients from one server with protocol 46, while protocol 6 refuses IPv4 clients."""
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        cls.server = spawn_server(["46", str(PORT), ROOT])
+
+    def get_index(self, addr: str):
+        r = requests.get("http://" + addr + ":" + str(PORT) + "/index.html")
+        self.assertEqual(HTTP_200, r.status_code)
+        self.assertEqual(MIME_HTML, r.headers["content-type"])
+        self.assertEqual(os.path.getsize(os.path.join(ROOT, "index.html")), len(r.content))
+
+    def test_ipv4(self):
+        self.get_index("127.0.0.1")
+
+    def test_ipv6(self):
+        self.get_index("[::1]")
+
+    def test_ipv6_only_refuses_ipv4(self):
+        server = spawn_server(["6", str(PORT + 1), ROOT], PORT + 1, ip_ver=6)
+        try:
+            with self.assertRaises(ConnectionRefusedError):
+                connect(PORT + 1, 4)
+        finally:
+            stop_server(server)
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        stop_server(cls.server)
+
+
+class TestBulkLanes(unittest.TestCase):
+    """Stalls every bulk slot with clients which never read their responses, and checks that a later bulk download is
+    still served once the stalled sends time out."""
+
+    BULK_SLOTS = 2
+    BULK_FILE_SIZE = 50 << 20
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        cls.root = tempfile.mkdtemp()
+        with open(os.path.join(cls.root, "bulk.bin"), "wb") as f:
+            f.write(b"b" * cls.BULK_FILE_SIZE)
+        cls.server = spawn_server(["-B", str(cls.BULK_SLOTS), str(IP_VER), str(PORT), cls.root])
+
+    def test_stalled_readers_release_bulk_slots(self):
+        stalled = []
+        for _ in range(self.BULK_SLOTS):
+            sock = connect()
+            sock.sendall(b"GET /bulk.bin HTTP/1.0\r\n\r\n")
+            stalled.append(sock)
+        time.sleep(0.5)
+        try:
+            r = requests.get(Request("/bulk.bin", HTTP_200, 0, None).path, timeout=SEND_TIMEOUT_SECS * SEND_TIMEOUTS_TO_ABANDON)
+            self.assertEqual(HTTP_200, r.status_code)
+            self.assertEqual(self.BULK_FILE_SIZE, len(r.content))
+        finally:
+            for sock in stalled:
+                sock.close()
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        stop_server(cls.server)
+        shutil.rmtree(cls.root)
+
+
+class TestAutoindex(unittest.TestCase):
+    """Serves directories without an index.html as listings, whose links must be escaped, percent-encoded and
+    relative, and which must change when files are added."""
+
+    # A name needing both HTML escapes and percent-encoding, and one which could be read as a scheme if not prefixed.
+    ESCAPED_NAME = "a&b <c>.txt"
+    SCHEME_NAME = "javascript:alert(1)"
+    SUBDIR_NAME = "sub dir"
+    # Directory mtimes are set this far in the past, since a directory modified within the current second is not cached.
+    PAST_SECS = 60
+
+    @classmethod
+    def setUpClass(cls) -> None:
+        cls.root = tempfile.mkdtemp()
+        for name in (cls.ESCAPED_NAME, cls.SCHEME_NAME):
+            with open(os.path.join(cls.root, name), "w") as f:
+                f.write(name)
+        cls.subdir = os.path.join(cls.root, cls.SUBDIR_NAME)
+        os.mkdir(cls.subdir)
+        cls.set_mtime_past(cls.subdir, cls.PAST_SECS)
+        cls.set_mtime_past(cls.root, cls.PAST_SECS)
+        cls.server = spawn_server(["-a", "-c", ".html=no-cache", str(IP_VER), str(PORT), cls.root])
+
+    @staticmethod
+    def set_mtime_past(path: str, secs: int):
+        past = time.time() - secs
+        os.utime(path, (past, past))
+
+    def get_listing(self, path: str) -> requests.Response:
+        r = requests.get(Request(path, HTTP_200, 0, None).path)
+        self.assertEqual(HTTP_200, r.status_code)
+        self.assertEqual(MIME_HTML, r.headers["Content-Type"])
+        self.assertEqual(len(r.content), int(r.headers["Content-Length"]))
+        return r
+
+    def test_root_listing(self):
+        r = self.get_listing("/")
+        self.assertIn('<a href="./a%26b%20%3Cc%3E.txt">a&amp;b &lt;c&gt;.txt</a>', r.text)
+        self.assertIn('<a href="./javascript%3Aalert%281%29">javascript:alert(1)</a>', r.text)
+        self.assertIn('<a href="./sub%20dir/">sub dir/</a>', r.text)
+        self.assertNotIn('href="../"', r.text)
+
+    def test_subdir_listing(self):
+        r = self.get_listing("/sub%20dir/")
+        self.assertIn("<title>Index of /sub dir/</title>", r.text)
+        self.assertIn('<a href="../">../</a>', r.text)
+
+    def test_listing_takes_html_cache_policy(self):
+        self.assertEqual("no-cache", self.get_listing("/").headers["Cache-Control"])
+
+    def test_fetch_through_hrefs(self):
+        base = Request("/", HTTP_200, 0, None).path
+        r = self.get_listing("/")
+        for href in re.findall(r'href="\./([^"/]+)"', r.text):
+            file = requests.get(base + href)
+            self.assertEqual(HTTP_200, file.status_code)
+            self.assertIn(file.text, (self.ESCAPED_NAME, self.SCHEME_NAME))
+            self.assertEqual(requests.utils.unquote(href), file.text)
+
+    def test_listing_changes_after_adding_file(self):
+        # Fetch twice so that the listing is cached, then add a file and check the cached listing is not served.
+        self.get_listing("/sub%20dir/")
+        self.assertNotIn("added.txt", self.get_listing("/sub%20dir/").text)
+        with open(os.path.join(self.subdir, "added.txt"), "w") as f:
+            f.write("added")
+        self.set_mtime_past(self.subdir, self.PAST_SECS // 2)
+        self.assertIn('<a href="./added.txt">added.txt</a>', self.get_listing("/sub%20dir/").text)
+
+    @classmethod
+    def tearDownClass(cls) -> None:
+        stop_server(cls.server)
+        shutil.rmtree(cls.root)
+
+
+class TestRestart(unittest.TestCase):
+    """Restarts with SIGHUP must refuse no connections, and draining must let in-flight downloads finish."""
+
+    DOWNLOAD_SIZE = 20 << 20
+    # Reading this much per pause keeps a download in flight for about a second.
+    DOWNLOAD_READ_SIZE = 256 << 10
+    DOWNLOAD_READ_PAUSE_SECS = 0.01
+    REQUEST_LOOP_SECS = 1.5
+    EXIT_TIMEOUT_SECS = 10
+
+    def setUp(self) -> None:
+        self.root = tempfile.mkdtemp()
+        shutil.copy(os.path.join(ROOT, "index.html"), self.root)
+        with open(os.path.join(self.root, "download.bin"), "wb") as f:
+            f.write(b"d" * self.DOWNLOAD_SIZE)
+        self.log = tempfile.NamedTemporaryFile(mode="w+")
+        self.server = spawn_server([str(IP_VER), str(PORT), self.root], stderr=self.log)
+        self.new_pid = None
+
+    def slow_download(self, results: list):
+        """Downloads the large file slowly, appending the number of body bytes received to results."""
+        sock = connect()
+        sock.sendall(b"GET /download.bin HTTP/1.0\r\n\r\n")
+        response = b""
+        while True:
+            chunk = sock.recv(self.DOWNLOAD_READ_SIZE)
+            if not chunk:
+                break
+            response += chunk
+            time.sleep(self.DOWNLOAD_READ_PAUSE_SECS)
+        sock.close()
+        results.append(len(response.partition(b"\r\n\r\n")[2]))
+
+    def start_slow_download(self, results: list) -> threading.Thread:
+        thread = threading.Thread(target=self.slow_download, args=(results,))
+        thread.start()
+        time.sleep(0.2)
+        return thread
+
+    def restart(self):
+        """Sends SIGHUP and waits for the new server process to take over, remembering its pid."""
+        self.server.send_signal(signal.SIGHUP)
+        deadline = time.monotonic() + SERVER_START_TIMEOUT_SECS
+        while self.new_pid is None and time.monotonic() < deadline:
+            time.sleep(0.05)
+            self.log.seek(0)
+            match = re.search(r"handed listening sockets to pid (\d+)", self.log.read())
+            if match:
+                self.new_pid = int(match.group(1))
+        self.assertIsNotNone(self.new_pid, "restart did not hand off")
+
+    def test_no_refused_connections_across_restart(self):
+        statuses = []
+        deadline = time.monotonic() + self.REQUEST_LOOP_SECS
+        restart_at = time.monotonic() + self.REQUEST_LOOP_SECS / 3
+        url = Request("/index.html", HTTP_200, 0, None).path
+        restart = threading.Thread(target=self.restart)
+        while time.monotonic() < deadline:
+            if not restart.is_alive() and time.monotonic() >= restart_at:
+                restart.start()
+                restart_at = deadline
+            statuses.append(requests.get(url).status_code)
+        restart.join()
+        self.assertEqual(0, self.server.wait(self.EXIT_TIMEOUT_SECS))
+        self.assertGreater(len(statuses), 0)
+        self.assertEqual([HTTP_200] * len(statuses), statuses)
+
+    def test_sigterm_drains_download(self):
+        results = []
+        download = self.start_slow_download(results)
+        self.server.send_signal(signal.SIGTERM)
+        download.join()
+        self.assertEqual([self.DOWNLOAD_SIZE], results)
+        self.assertEqual(0, self.server.wait(self.EXIT_TIMEOUT_SECS))
+
+    def test_sighup_while_draining_is_ignored(self):
+        results = []
+        download = self.start_slow_download(results)
+        self.restart()
+        # The old process is now draining the download: a second deploy must not cut it off.
+        self.server.send_signal(signal.SIGHUP)
+        download.join()
+        self.assertEqual([self.DOWNLOAD_SIZE], results)
+        self.assertEqual(0, self.server.wait(self.EXIT_TIMEOUT_SECS))
+
+    def tearDown(self) -> None:
+        if self.server.poll() is None:
+            stop_server(self.server)
+        # The new server process is not a child of this one, so wait for it to stop listening instead.
+        if self.new_pid:
+            os.kill(self.new_pid, signal.SIGINT)
+            deadline = time.monotonic() + self.EXIT_TIMEOUT_SECS
+            while time.monotonic() < deadline:
+                try:
+                    connect().close()
+                    time.sleep(0.05)
+                except ConnectionRefusedError:
+                    break
+        self.log.close()
+        shutil.rmtree(self.root)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,182 @@
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+// linux/errqueue.h uses struct timespec without including time.h itself.
+#include <linux/errqueue.h>
+
+#include "zerocopy.h"
+
+#define ERRQUEUE_CONTROL_SIZE 128
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+// How long to wait for the remaining completions once the connection has been aborted. Purged buffers are released
+// immediately, and any still held by the network device as soon as it has transmitted them.
+#define ABORT_WAIT_MS 1000
+
+// MSG_ZEROCOPY transmission for bytes held in user memory.
+
+// Function prototypes.
+static bool is_loopback_peer(int sockfd);
+static bool wait_completions(int sockfd, zerocopy_t *zc, int timeout_ms);
+static bool zerocopy_read_completions(int sockfd, zerocopy_t *zc);
+static void abort_connection(int sockfd);
+static long ms_until(const struct timespec *deadline);
+
+// Sends from buf without copying it into the kernel, falling back to a plain send() where that is not possible.
+ssize_t zerocopy_send(int sockfd, const void *buf, size_t len, zerocopy_t *zc) {
+    // Opt the socket in on first use, remembering if it cannot be. Loopback traffic is always copied by the kernel, so
+    // requesting zero-copy there only adds the cost of pinning pages and waiting for completions.
+    if (!zc->is_enabled && !zc->is_unsupported) {
+        int enable = 1;
+        if (!is_loopback_peer(sockfd) && setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0) {
+            zc->is_enabled = true;
+        } else {
+            zc->is_unsupported = true;
+        }
+    }
+    if (zc->is_unsupported) {
+        return send(sockfd, buf, len, 0);
+    }
+
+    // Every successful MSG_ZEROCOPY send, even a partial one, is numbered sequentially by the kernel for completions.
+    ssize_t n = send(sockfd, buf, len, MSG_ZEROCOPY);
+    if (n >= 0) {
+        zc->n_sent++;
+    } else if (errno == ENOBUFS) {
+        // Over the socket's limit of pinned memory: copy this time instead.
+        n = send(sockfd, buf, len, 0);
+    }
+    return n;
+}
+
+// Waits until the kernel has released every buffer sent with zerocopy_send() on the socket, for at most timeout_ms. A
+// peer which stops acknowledging keeps the buffers pinned, so past the timeout the connection is aborted instead.
+bool zerocopy_wait(int sockfd, zerocopy_t *zc, int timeout_ms) {
+    if (wait_completions(sockfd, zc, timeout_ms)) {
+        return true;
+    }
+    abort_connection(sockfd);
+    if (!wait_completions(sockfd, zc, ABORT_WAIT_MS)) {
+        fprintf(stderr, "server: zerocopy buffers still pinned after aborting the connection.\n");
+    }
+    return false;
+}
+
+// Reads completions as they arrive until every send has completed, returning false if timeout_ms elapses first.
+static bool wait_completions(int sockfd, zerocopy_t *zc, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / MS_PER_SEC;
+    deadline.tv_nsec += (long)(timeout_ms % MS_PER_SEC) * NS_PER_MS;
+
+    while (zc->n_completed != zc->n_sent) {
+        long remaining_ms = ms_until(&deadline);
+        if (remaining_ms <= 0) {
+            return false;
+        }
+        // Completions arrive on the error queue, which poll() reports as POLLERR without needing to ask for it.
+        struct pollfd pfd = {.fd = sockfd, .events = 0};
+        int n_ready = poll(&pfd, 1, (int)remaining_ms);
+        if (n_ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll: zerocopy");
+            return false;
+        }
+        if (pfd.revents & POLLNVAL) {
+            return false;
+        }
+        // POLLERR is also reported for a pending socket error, e.g. a reset, with nothing on the error queue. Reading
+        // the error clears it, so that poll() blocks again until a completion actually arrives.
+        if ((pfd.revents & POLLERR) && !zerocopy_read_completions(sockfd, zc)) {
+            int sock_err;
+            socklen_t sock_err_len = sizeof(sock_err);
+            getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &sock_err, &sock_err_len);
+        }
+    }
+    return true;
+}
+
+// Whether the socket is connected to a loopback address.
+static bool is_loopback_peer(int sockfd) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        return false;
+    }
+    if (addr.ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)&addr;
+        return (ntohl(in->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (addr.ss_family == AF_INET6) {
+        const struct in6_addr *in6 = &((const struct sockaddr_in6 *)&addr)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(in6) || (IN6_IS_ADDR_V4MAPPED(in6) && in6->s6_addr[12] == 127);
+    }
+    return false;
+}
+
+// Reads one batch of completion notifications. Each covers an inclusive range of send numbers. Returns false if the
+// error queue was empty.
+static bool zerocopy_read_completions(int sockfd, zerocopy_t *zc) {
+    union {
+        char buf[ERRQUEUE_CONTROL_SIZE];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {0};
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("recvmsg: zerocopy");
+            // Nothing more can be learnt from this socket: stop waiting.
+            zc->n_completed = zc->n_sent;
+        }
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        bool is_recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                          (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+        if (!is_recverr) {
+            continue;
+        }
+        struct sock_extended_err serr;
+        memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+        if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+        }
+        zc->n_completed += serr.ee_data - serr.ee_info + 1;
+
+        // The kernel had to copy after all, e.g. over loopback, so pinning only added overhead.
+        if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+            zc->is_unsupported = true;
+        }
+    }
+    return true;
+}
+
+// Resets the connection, purging the data it has yet to send, which releases the buffers pinned by it. SO_LINGER of
+// zero alone would only reset on close(), once the completions could no longer be read, so the connection is
+// dissolved with an AF_UNSPEC connect(), which runs the same abort while keeping the socket open.
+static void abort_connection(int sockfd) {
+    struct linger linger = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+    if (connect(sockfd, &unspec, sizeof(unspec)) < 0) {
+        perror("connect: zerocopy abort");
+    }
+}
+
+static long ms_until(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (deadline->tv_sec - now.tv_sec) * MS_PER_SEC + (deadline->tv_nsec - now.tv_nsec) / NS_PER_MS;
+}
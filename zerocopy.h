@@ -0,0 +1,47 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// MSG_ZEROCOPY transmission for bytes held in user memory. Instead of copying the buffer into the kernel on send(), the
+// kernel pins its pages and transmits from them directly, then reports on the socket's error queue once it has released
+// them. Until then, the buffer must be neither modified nor freed. Pinning and completion notifications have a fixed
+// cost, so this only beats copying for larger buffers: see bench_zerocopy.c.
+
+// Only exposed by glibc's <sys/socket.h> for _GNU_SOURCE, but fixed by the kernel ABI.
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+// Sends at or above this many bytes use MSG_ZEROCOPY by default. Kernel documentation puts the break-even point on a
+// NIC at around 10 KB, and waiting for each response's completions costs a little more here. Not measured across a
+// real NIC: bench_zerocopy only runs over loopback without a remote sink.
+#define ZEROCOPY_DEFAULT_THRESHOLD (16 * 1024)
+
+// Zero-copy state of one socket, tracking sends which the kernel may still be reading from.
+typedef struct zerocopy_t {
+    bool is_enabled;
+    // Set when the socket cannot send without copying (e.g. unix sockets or loopback peers), or the kernel reported it
+    // copied anyway, after which plain sends are used.
+    bool is_unsupported;
+    uint32_t n_sent;
+    uint32_t n_completed;
+} zerocopy_t;
+
+#define ZEROCOPY_INIT {.is_enabled = false, .is_unsupported = false, .n_sent = 0, .n_completed = 0}
+
+// Sends from buf without copying it into the kernel, falling back to a plain send() where that is not possible. Returns
+// as send() does. buf must stay valid and unmodified until zerocopy_wait() returns.
+ssize_t zerocopy_send(int sockfd, const void *buf, size_t len, zerocopy_t *zc);
+
+// Blocks until the kernel has released every buffer sent with zerocopy_send() on the socket, for at most timeout_ms.
+// A peer which stops acknowledging would otherwise keep the buffers pinned indefinitely, so past the timeout the
+// connection is reset, purging its unsent data, and the resulting completions are collected. Returns false if the
+// connection was reset. Either way, the buffers may then be freed.
+bool zerocopy_wait(int sockfd, zerocopy_t *zc, int timeout_ms);
+
+#endif // !ZEROCOPY_H